@@ -0,0 +1,82 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "AffineAxis.hpp"
+#include "wire_util.hpp"
+
+namespace cppmpl {
+
+// Values checked between looks at whether a difference was found, so data
+// that is not affine is rejected early
+static const size_t BLOCK = 1024;
+
+//======================================================================
+bool DetectAffine(const double *data, size_t count, double tolerance,
+                  double *start, double *step) {
+  if (count == 0) {
+    return false;
+  }
+  const double first = data[0];
+  const double spacing = count > 1 ? (data[count - 1] - first) / (count - 1)
+                                   : 0.0;
+  if (!std::isfinite(first) || !std::isfinite(spacing)) {
+    return false;
+  }
+
+  // Comparisons are written so that NaN counts as a difference
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128d vfirst = _mm_set1_pd(first);
+  const __m128d vspacing = _mm_set1_pd(spacing);
+  const __m128d vtolerance = _mm_set1_pd(tolerance);
+  const __m128d two = _mm_set1_pd(2.0);
+  const __m128d abs_mask = _mm_castsi128_pd(
+      _mm_set1_epi64x(0x7fffffffffffffffLL));
+  __m128d index = _mm_set_pd(1.0, 0.0);
+  while (i + 2 <= count) {
+    const size_t end = std::min(count & ~size_t{1}, i + BLOCK);
+    __m128d differs = _mm_setzero_pd();
+    for (; i != end; i += 2) {
+      const __m128d expected = _mm_add_pd(vfirst, _mm_mul_pd(vspacing, index));
+      const __m128d error = _mm_and_pd(
+          _mm_sub_pd(_mm_loadu_pd(data + i), expected), abs_mask);
+      differs = _mm_or_pd(differs, _mm_cmpnle_pd(error, vtolerance));
+      index = _mm_add_pd(index, two);
+    }
+    if (_mm_movemask_pd(differs) != 0) {
+      return false;
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    const double expected = first + spacing * static_cast<double>(i);
+    if (!(std::fabs(data[i] - expected) <= tolerance)) {
+      return false;
+    }
+  }
+
+  *start = first;
+  *step = spacing;
+  return true;
+}
+
+//======================================================================
+void AffineAxis::SerializeHeaderTo (std::vector<uint8_t> *buffer) const {
+  buffer->clear();
+  Append(start_, buffer);
+  Append(step_, buffer);
+  Append(count_, buffer);
+  buffer->insert(buffer->end(), name_.begin(), name_.end());
+}
+
+} // namespace
@@ -0,0 +1,93 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cppmpl {
+
+//--------------------------------------------------
+/** \brief Checks in one pass whether data[i] is start + step*i for every i,
+ * to within tolerance, with start and step taken from the first and last
+ * values.
+ *
+ * \param data  the values, e.g. timestamps.
+ * \param count  the number of values.
+ * \param tolerance  the largest absolute difference allowed.
+ * \param start  set to the first value if data is affine.
+ * \param step  set to the spacing if data is affine.
+ *
+ * \returns whether data is affine.  Data with NaN or infinities never is.
+ */
+bool DetectAffine(const double *data, size_t count, double tolerance,
+                  double *start, double *step);
+
+
+//======================================================================
+/** \brief A uniformly spaced axis, start + step*i for i below count, sent
+ * as just those three numbers.
+ *
+ * In the iPython session it becomes an AffineAxis that behaves as a 1D
+ * float64 array, but only computes its values when something needs them.
+ * Lengths, single values and slices are computed without doing so, so
+ * plotting every tenth sample stays cheap.
+ *
+ * Usage:
+\code
+    AffineAxis time("Time", t0, 1.0 / sample_rate, samples.size());
+    mpl.SendAxis(time);
+    mpl.SendData(NumpyArray("Signal", samples));
+    mpl.RunCode("plot(Time, Signal)");
+
+    // Or, for timestamps that may or may not be evenly spaced
+    mpl.SendAxis("Time", stamps.data(), stamps.size(), 1e-9);
+\endcode
+ */
+class AffineAxis {
+public:
+  //--------------------------------------------------
+  /** \brief Constructs an axis associated with a named variable in the
+   * iPython session.
+   *
+   * \param name  the name the axis will have in the ipython session.
+   * \param start  the first value.
+   * \param step  the difference between consecutive values.
+   * \param count  the number of values.
+   */
+  AffineAxis (const std::string &name, double start, double step,
+              uint64_t count)
+    : name_{name}, start_{start}, step_{step}, count_{count}
+  {}
+
+  //--------------------------------------------------
+  /** \brief Serializes the start, step, count and name.
+   *
+   * \param buffer  the byte buffer to be serialized into.  Overwrites
+   *                previous contents.
+   */
+  void SerializeHeaderTo (std::vector<uint8_t> *buffer) const;
+
+  double Start (void) const { return start_; }
+  double Step (void) const { return step_; }
+  uint64_t Count (void) const { return count_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the name of the iPython variable this axis is associated
+   * with.
+   */
+  std::string Name (void) const { return name_; }
+
+private:
+  std::string name_;
+  double start_;
+  double step_;
+  uint64_t count_;
+};
+
+} // namespace
@@ -0,0 +1,81 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <stdexcept>
+
+#include "Broadcast.hpp"
+
+namespace cppmpl {
+
+//======================================================================
+Broadcast::Broadcast (size_t max_pending) :
+    max_pending_{max_pending}
+{}
+
+size_t Broadcast::AddTarget (const std::string &config_filename,
+                             const TransportOptions &options) {
+  std::unique_ptr<Target> target{new Target};
+  target->client.reset(new ThreadedClient{config_filename, options});
+  target->pending = 0;
+  target->skipped = 0;
+  targets_.push_back(std::move(target));
+  return targets_.size() - 1;
+}
+
+std::vector<std::future<void>> Broadcast::SendData (const NumpyArray &data) {
+  // Every target's messages point into this one buffer, which lives until
+  // the last of their tasks is done with it.
+  auto buffer = std::make_shared<std::vector<uint8_t>>(data.WireSize());
+  data.SerializeTo(buffer.get());
+  return Submit_([buffer] (CppMatplotlib &mpl) {
+    mpl.SendSerialized(buffer->data(), buffer->size());
+  });
+}
+
+std::vector<std::future<void>> Broadcast::RunCode (const std::string &code) {
+  auto shared = std::make_shared<const std::string>(code);
+  return Submit_([shared] (CppMatplotlib &mpl) { mpl.RunCode(*shared); });
+}
+
+size_t Broadcast::Pending (size_t target) const {
+  return targets_[target]->pending.load();
+}
+
+uint64_t Broadcast::Skipped (size_t target) const {
+  return targets_[target]->skipped.load();
+}
+
+std::vector<std::future<void>> Broadcast::Submit_ (
+    const ThreadedClient::Task &task) {
+  std::vector<std::future<void>> delivered;
+  delivered.reserve(targets_.size());
+  for (size_t i = 0; i != targets_.size(); ++i) {
+    Target *target = targets_[i].get();
+    if (max_pending_ != 0 && target->pending.load() >= max_pending_) {
+      ++target->skipped;
+      std::promise<void> skipped;
+      skipped.set_exception(std::make_exception_ptr(std::runtime_error(
+          "Broadcast target " + std::to_string(i) + " is too far behind")));
+      delivered.push_back(skipped.get_future());
+      continue;
+    }
+
+    ++target->pending;
+    delivered.push_back(target->client->Submit(
+        [task, target] (CppMatplotlib &mpl) {
+          try {
+            task(mpl);
+          } catch (...) {
+            --target->pending;
+            throw;
+          }
+          --target->pending;
+        }));
+  }
+  return delivered;
+}
+
+} // namespace
@@ -0,0 +1,113 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ThreadedClient.hpp"
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief Mirrors the same arrays and code to several iPython kernels.
+ *
+ * Each array is serialized once into a reference counted buffer, and every
+ * kernel's zero-copy messages are sent straight from it; the buffer is
+ * freed once the last kernel has it.  Each kernel has a ThreadedClient of
+ * its own, so sends to all of them go concurrently and a slow kernel only
+ * holds up itself.  With a limit on pending requests, a kernel that falls
+ * that far behind misses requests rather than queueing them all.
+ *
+ * Usage:
+\code
+    Broadcast group{8};
+    group.AddTarget("/path/to/alice/kernel-NNN.json");
+    group.AddTarget("/path/to/bob/kernel-NNN.json");
+
+    std::vector<std::future<void>> delivered =
+        group.SendData(NumpyArray{"Telemetry", samples});
+    for (size_t i = 0; i != delivered.size(); ++i) {
+      try {
+        delivered[i].get();
+      } catch (const std::exception &e) {
+        // ... target i did not get it, e.what() says why ...
+      }
+    }
+\endcode
+ */
+class Broadcast {
+public:
+  //--------------------------------------------------
+  /** \param max_pending  how many requests a target may have queued or in
+   *                     flight before further ones skip it, 0 for no limit.
+   */
+  explicit Broadcast (size_t max_pending = 0);
+
+  Broadcast (const Broadcast&) = delete;
+  Broadcast& operator= (const Broadcast&) = delete;
+
+  //--------------------------------------------------
+  /** \brief Connects to another kernel, as ThreadedClient does.  Not to be
+   * called while other threads are sending.
+   *
+   * \returns the target's index, which its delivery status has in the
+   *          results of SendData and RunCode.
+   */
+  size_t AddTarget (const std::string &config_filename,
+                    const TransportOptions &options = TransportOptions{});
+
+  //--------------------------------------------------
+  /** \brief Sends an array to every target, serializing it only once.
+   *
+   * \returns a future per target, ready once that target has the array or
+   *          holding the reason it does not.
+   */
+  std::vector<std::future<void>> SendData (const NumpyArray &data);
+
+  //--------------------------------------------------
+  /** \brief Runs code in every target, as CppMatplotlib::RunCode.
+   *
+   * \returns a future per target, as SendData.
+   */
+  std::vector<std::future<void>> RunCode (const std::string &code);
+
+  //--------------------------------------------------
+  /** \brief Returns the client for one target, e.g. to Identify.
+   */
+  ThreadedClient& Client (size_t target) { return *targets_[target]->client; }
+
+  //--------------------------------------------------
+  /** \brief Returns how many requests a target has queued or in flight.
+   */
+  size_t Pending (size_t target) const;
+
+  //--------------------------------------------------
+  /** \brief Returns how many requests a target has missed for being too
+   * far behind.
+   */
+  uint64_t Skipped (size_t target) const;
+
+  size_t Size (void) const { return targets_.size(); }
+
+private:
+  struct Target {
+    std::unique_ptr<ThreadedClient> client;
+    std::atomic<size_t> pending;
+    std::atomic<uint64_t> skipped;
+  };
+
+  std::vector<std::future<void>> Submit_ (const ThreadedClient::Task &task);
+
+  const size_t max_pending_;
+  std::vector<std::unique_ptr<Target>> targets_;
+};
+
+} // namespace
@@ -0,0 +1,181 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <cerrno>
+#include <iterator>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "Broker.hpp"
+#include "RequestSink.hpp"
+
+namespace cppmpl {
+
+// Commands the broker handles itself rather than passing to the listener
+static const std::string RUN{"run"};
+static const std::string HELLO{"hello"};
+static const std::string PRIORITY{"priority"};
+static const std::string URGENT{"urgent"};
+static const std::string BULK{"bulk"};
+
+// The listener's defaults for a client that has not said hello
+static const std::vector<std::string> ANONYMOUS{"", "", "1"};
+
+// Clients whose hello and priority are remembered.  One left idle while
+// this many others attach is treated as anonymous and bulk from then on.
+static const size_t MAX_CLIENTS = 4096;
+
+static std::string ToString(const zmq::message_t &message) {
+  return std::string{static_cast<const char*>(message.data()),
+                     message.size()};
+}
+
+//======================================================================
+Broker::Broker (const std::string &config_filename,
+                const std::string &endpoint, const TransportOptions &options) :
+    endpoint_{endpoint},
+    mpl_{config_filename, options},
+    context_{options.io_threads},
+    socket_{context_, ZMQ_ROUTER},
+    stopping_{false},
+    active_hello_(ANONYMOUS),
+    active_urgent_{false}
+{
+  mpl_.Connect();
+  ConfigureSocket(options, &socket_);
+  socket_.bind(endpoint_.c_str());
+}
+
+Broker::~Broker (void) {
+  // Leave no socket file behind
+  socket_.close();
+  if (endpoint_.compare(0, 6, "ipc://") == 0) {
+    unlink(endpoint_.c_str() + 6);
+  }
+}
+
+void Broker::Run (void) {
+  zmq::pollitem_t item{static_cast<void*>(socket_), 0, ZMQ_POLLIN, 0};
+  while (!stopping_) {
+    try {
+      zmq::poll(&item, 1, 100);
+    } catch (const zmq::error_t &e) {
+      // A signal, perhaps the one that stops us
+      if (e.num() != EINTR) {
+        throw;
+      }
+      continue;
+    }
+    if (!(item.revents & ZMQ_POLLIN)) {
+      continue;
+    }
+
+    std::vector<zmq::message_t> request;
+    do {
+      request.emplace_back();
+      socket_.recv(&request.back());
+    } while (request.back().more());
+    Serve_(&request);
+  }
+}
+
+void Broker::Serve_ (std::vector<zmq::message_t> *request) {
+  // A REQ client's request is its identity, an empty delimiter and then the
+  // frames it sent.
+  if (request->size() < 3) {
+    return;
+  }
+  const std::string client = ToString((*request)[0]);
+  std::vector<zmq::message_t> frames(
+      std::make_move_iterator(request->begin() + 2),
+      std::make_move_iterator(request->end()));
+
+  std::string status{"Success"};
+  std::vector<zmq::message_t> reply;
+  try {
+    reply = Forward_(client, &frames);
+  } catch (const std::exception &e) {
+    status = e.what();
+  }
+
+  socket_.send((*request)[0], ZMQ_SNDMORE);
+  socket_.send((*request)[1], ZMQ_SNDMORE);
+  socket_.send(status.data(), status.size(), reply.empty() ? 0 : ZMQ_SNDMORE);
+  for (size_t i = 0; i != reply.size(); ++i) {
+    socket_.send(reply[i], i + 1 != reply.size() ? ZMQ_SNDMORE : 0);
+  }
+}
+
+std::vector<zmq::message_t> Broker::Forward_ (
+    const std::string &client, std::vector<zmq::message_t> *frames) {
+  const std::string command = frames->size() > 1 ? ToString(frames->front())
+                                                 : std::string{};
+  if (command == RUN) {
+    mpl_.RunCode(ToString((*frames)[1]));
+    return {};
+  }
+
+  std::vector<Frame> request;
+  for (zmq::message_t &frame : *frames) {
+    request.emplace_back(frame.data(), frame.size());
+  }
+
+  if (command == HELLO) {
+    // Passed on at once, so the listener can reject it
+    std::vector<zmq::message_t> reply = mpl_.upData_conn_->Request(request);
+    std::vector<std::string> hello;
+    for (size_t i = 1; i != frames->size(); ++i) {
+      hello.push_back(ToString((*frames)[i]));
+    }
+    Remember_(client).hello = hello;
+    active_hello_ = hello;
+    return reply;
+  }
+
+  if (command == PRIORITY) {
+    // Replayed before this client's requests like its hello, as the
+    // listener would otherwise make every attached client urgent
+    Remember_(client).urgent = ToString((*frames)[1]) == URGENT;
+    return {};
+  }
+
+  auto found = clients_.find(client);
+  if (found != clients_.end()) {
+    recent_.splice(recent_.begin(), recent_, found->second.recent);
+  }
+  const std::vector<std::string> &hello =
+      found != clients_.end() ? found->second.hello : ANONYMOUS;
+  if (hello != active_hello_) {
+    std::vector<Frame> introduction{HELLO};
+    introduction.insert(introduction.end(), hello.begin(), hello.end());
+    mpl_.upData_conn_->Request(introduction);
+    active_hello_ = hello;
+  }
+  const bool urgent = found != clients_.end() && found->second.urgent;
+  if (urgent != active_urgent_) {
+    mpl_.upData_conn_->Request({PRIORITY, urgent ? URGENT : BULK});
+    active_urgent_ = urgent;
+  }
+  return mpl_.upData_conn_->Request(request);
+}
+
+Broker::Client& Broker::Remember_ (const std::string &client) {
+  auto found = clients_.find(client);
+  if (found != clients_.end()) {
+    recent_.splice(recent_.begin(), recent_, found->second.recent);
+    return found->second;
+  }
+  recent_.push_front(client);
+  Client &state = clients_[client];
+  state = Client{ANONYMOUS, false, recent_.begin()};
+  if (clients_.size() > MAX_CLIENTS) {
+    clients_.erase(recent_.back());
+    recent_.pop_back();
+  }
+  return state;
+}
+
+} // namespace
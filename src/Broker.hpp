@@ -0,0 +1,95 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <zmq.hpp>
+
+#include "cpp_mpl.hpp"
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief Holds one connection to an iPython kernel open on behalf of many
+ * short-lived local processes, which attach with CppMatplotlib::Attach.
+ *
+ * The kernel config is parsed, the session connected and the listener
+ * bootstrapped once, when the broker starts.  Attaching is then a single
+ * connect to the broker's Unix domain socket.  Requests from all attached
+ * clients are served one at a time, in arrival order, over the broker's own
+ * connection.
+ *
+ * Usage:
+\code
+    Broker broker{"/path/to/kernel-NNN.json"};
+    broker.Run();   // until Stop
+\endcode
+ */
+class Broker {
+public:
+  //--------------------------------------------------
+  /** \brief Connects to the kernel and binds the broker endpoint.
+   *
+   * \param config_filename  the kernel's connection file.
+   * \param endpoint  where clients attach.
+   * \param options  socket settings for the kernel connection.
+   */
+  explicit Broker (const std::string &config_filename,
+                   const std::string &endpoint = DefaultBrokerEndpoint(),
+                   const TransportOptions &options = TransportOptions{});
+  ~Broker (void);
+
+  //--------------------------------------------------
+  /** \brief Serves clients until Stop is called.
+   */
+  void Run (void);
+
+  //--------------------------------------------------
+  /** \brief Makes Run return within a tenth of a second.  Safe to call from
+   * another thread or a signal handler.
+   */
+  void Stop (void) { stopping_ = true; }
+
+  const std::string& Endpoint (void) const { return endpoint_; }
+
+private:
+  void Serve_ (std::vector<zmq::message_t> *request);
+  std::vector<zmq::message_t> Forward_ (
+      const std::string &client, std::vector<zmq::message_t> *frames);
+  struct Client;
+  Client& Remember_ (const std::string &client);
+
+  const std::string endpoint_;
+  CppMatplotlib mpl_;
+  zmq::context_t context_;
+  zmq::socket_t socket_;
+  std::atomic<bool> stopping_;
+
+  struct Client {
+    std::vector<std::string> hello;
+    bool urgent;
+    std::list<std::string>::iterator recent;
+  };
+
+  // The name, prefix and weight each client introduced itself with and
+  // whether it asked to be urgent, and the ones the listener was last
+  // given.  The listener sees the broker as a single client, so these are
+  // replayed whenever the client changes.  Every attaching process has a
+  // new identity, so only the most recently active clients are remembered,
+  // most recent first.
+  std::unordered_map<std::string, Client> clients_;
+  std::list<std::string> recent_;
+  std::vector<std::string> active_hello_;
+  bool active_urgent_;
+};
+
+} // namespace
@@ -0,0 +1,63 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <stdexcept>
+
+#include "CommChannel.hpp"
+
+namespace cppmpl {
+
+// Registered in the kernel by cpp_ipython_register_comm
+static const std::string TARGET_NAME{"cpp_matplotlib"};
+
+//======================================================================
+CommChannel::CommChannel (IPythonSession *session) :
+    session_{session},
+    comm_id_{GetUuid()},
+    open_{false}
+{}
+
+CommChannel::~CommChannel (void) {
+  if (open_) {
+    try {
+      session_->Shell().CloseComm(comm_id_);
+    } catch (...) {
+      // The kernel cleans up after dead comms anyway
+    }
+  }
+}
+
+void CommChannel::Open (void) {
+  // A SUB socket misses everything published before its subscription
+  // reaches the kernel, so poke the kernel until its status messages arrive.
+  IOPubConnection &iopub = session_->IOPub();
+  ShellConnection &shell = session_->Shell();
+  for (int attempt = 0; ; ++attempt) {
+    shell.KernelInfo();
+    if (iopub.Poll(100)) {
+      break;
+    }
+    if (attempt == 50) {
+      throw std::runtime_error("Nothing received from the kernel's iopub");
+    }
+  }
+  iopub.Discard();
+
+  shell.OpenComm(comm_id_, TARGET_NAME);
+  open_ = true;
+}
+
+std::vector<zmq::message_t> CommChannel::Transmit_ (
+    const std::vector<Frame> &frames) {
+  // Status and output of everything since the last request piles up here,
+  // and once it reaches the high water mark the kernel drops our reply.
+  IOPubConnection &iopub = session_->IOPub();
+  iopub.Discard();
+  const std::string msg_id = session_->Shell().SendComm(comm_id_, frames);
+  return iopub.ReceiveCommReply(msg_id);
+}
+
+} // namespace
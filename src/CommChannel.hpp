@@ -0,0 +1,67 @@
+// 
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+// 
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "ipython_protocol.hpp"
+#include "RequestSink.hpp"
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief A DataChannel for kernels speaking messaging protocol 5, which
+ * sends requests as the binary buffers of comm messages on the shell socket.
+ *
+ * There is no listener thread or extra port, and data is ordered with the
+ * code run through the same shell socket.  The kernel must have the
+ * "cpp_matplotlib" comm target registered, by cpp_ipython_register_comm.
+ *
+ * Usage:
+\code
+    CommChannel channel{&session};
+    channel.Open();
+    channel.Request({"fetch", "MyArray"});
+\endcode
+ */
+class CommChannel : public DataChannel {
+public:
+  //--------------------------------------------------
+  /** \param session  a connected session, which must outlive the channel.
+   */
+  explicit CommChannel (IPythonSession *session);
+
+  //--------------------------------------------------
+  /** \brief Closes the comm, if it was opened.
+   */
+  ~CommChannel (void);
+
+  CommChannel (const CommChannel&) = delete;
+  CommChannel& operator= (const CommChannel&) = delete;
+
+  //--------------------------------------------------
+  /** \brief Subscribes to the kernel's IOPub socket and opens the comm.
+   *
+   * \throws std::runtime_error  if nothing arrives on the IOPub socket.
+   */
+  void Open (void);
+
+private:
+  //--------------------------------------------------
+  /** \brief Sends frames as the buffers of one comm message and waits for
+   * the reply.
+   */
+  std::vector<zmq::message_t> Transmit_ (
+      const std::vector<Frame> &frames) override;
+
+  IPythonSession *session_;
+  const std::string comm_id_;
+  bool open_;
+};
+
+} // namespace
@@ -0,0 +1,136 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <cstring>
+
+#include "ContentCache.hpp"
+
+namespace cppmpl {
+
+static const uint64_t PRIME1 = 11400714785074694791ULL;
+static const uint64_t PRIME2 = 14029467366897019727ULL;
+static const uint64_t PRIME3 = 1609587929392839161ULL;
+static const uint64_t PRIME4 = 9650029242287828579ULL;
+static const uint64_t PRIME5 = 2870177450012600261ULL;
+
+static inline uint64_t RotateLeft (uint64_t x, int bits) {
+  return (x << bits) | (x >> (64 - bits));
+}
+
+// Little endian, as XXH64 is defined, which is also the host order on
+// every platform the listener's struct formats assume.
+static inline uint64_t Read64 (const uint8_t *p) {
+  uint64_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint32_t Read32 (const uint8_t *p) {
+  uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint64_t Round (uint64_t acc, uint64_t input) {
+  acc += input * PRIME2;
+  acc = RotateLeft(acc, 31);
+  return acc * PRIME1;
+}
+
+static inline uint64_t Merge (uint64_t acc, uint64_t lane) {
+  acc ^= Round(0, lane);
+  return acc * PRIME1 + PRIME4;
+}
+
+uint64_t ContentHash (const void *data, size_t size, uint64_t seed) {
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  const uint8_t *const end = p + size;
+  uint64_t hash;
+
+  if (size >= 32) {
+    uint64_t v1 = seed + PRIME1 + PRIME2;
+    uint64_t v2 = seed + PRIME2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME1;
+    for (; p + 32 <= end; p += 32) {
+      v1 = Round(v1, Read64(p));
+      v2 = Round(v2, Read64(p + 8));
+      v3 = Round(v3, Read64(p + 16));
+      v4 = Round(v4, Read64(p + 24));
+    }
+    hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) +
+        RotateLeft(v3, 12) + RotateLeft(v4, 18);
+    hash = Merge(hash, v1);
+    hash = Merge(hash, v2);
+    hash = Merge(hash, v3);
+    hash = Merge(hash, v4);
+  } else {
+    hash = seed + PRIME5;
+  }
+
+  hash += size;
+  for (; p + 8 <= end; p += 8) {
+    hash ^= Round(0, Read64(p));
+    hash = RotateLeft(hash, 27) * PRIME1 + PRIME4;
+  }
+  if (p + 4 <= end) {
+    hash ^= Read32(p) * PRIME1;
+    hash = RotateLeft(hash, 23) * PRIME2 + PRIME3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    hash ^= *p * PRIME5;
+    hash = RotateLeft(hash, 11) * PRIME1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= PRIME2;
+  hash ^= hash >> 29;
+  hash *= PRIME3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+//======================================================================
+ContentCache::ContentCache (size_t capacity_bytes) :
+    capacity_{capacity_bytes},
+    used_{0}
+{}
+
+bool ContentCache::Touch (uint64_t hash) {
+  auto found = index_.find(hash);
+  if (found == index_.end()) {
+    return false;
+  }
+  entries_.splice(entries_.begin(), entries_, found->second);
+  return true;
+}
+
+void ContentCache::Insert (uint64_t hash, size_t bytes) {
+  if (Touch(hash)) {
+    return;
+  }
+  entries_.emplace_front(hash, bytes);
+  index_[hash] = entries_.begin();
+  used_ += bytes;
+  while (used_ > capacity_ && !entries_.empty()) {
+    used_ -= entries_.back().second;
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
+void ContentCache::Erase (uint64_t hash) {
+  auto found = index_.find(hash);
+  if (found == index_.end()) {
+    return;
+  }
+  used_ -= found->second->second;
+  entries_.erase(found->second);
+  index_.erase(found);
+}
+
+} // namespace
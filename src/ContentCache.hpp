@@ -0,0 +1,69 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace cppmpl {
+
+//--------------------------------------------------
+/** \brief Hashes a block of memory with XXH64.
+ *
+ * Four independent lanes of 8 bytes are mixed per step, which runs at
+ * several GB/s, comfortably faster than any transport to the kernel.
+ *
+ * \param data  the block.
+ * \param size  the number of bytes in the block.
+ * \param seed  varies the hash.
+ */
+uint64_t ContentHash(const void *data, size_t size, uint64_t seed = 0);
+
+//======================================================================
+/** \brief The hashes of buffers believed to be held by the kernel, evicted
+ * least recently used first once their total size exceeds a capacity.
+ *
+ * It mirrors the kernel's own cache of the same capacity.  The kernel may
+ * still evict sooner, e.g. when other clients share it, so a hit is only a
+ * hint.
+ */
+class ContentCache {
+public:
+  explicit ContentCache (size_t capacity_bytes);
+
+  //--------------------------------------------------
+  /** \brief Returns whether hash is held, making it the most recently used
+   * if so.
+   */
+  bool Touch (uint64_t hash);
+
+  //--------------------------------------------------
+  /** \brief Adds hash as the most recently used, evicting as needed.
+   */
+  void Insert (uint64_t hash, size_t bytes);
+
+  //--------------------------------------------------
+  /** \brief Forgets hash, if held.
+   */
+  void Erase (uint64_t hash);
+
+  size_t Capacity (void) const { return capacity_; }
+
+private:
+  typedef std::list<std::pair<uint64_t, size_t>> Entries;
+
+  const size_t capacity_;
+  size_t used_;
+  // Most recently used first
+  Entries entries_;
+  std::unordered_map<uint64_t, Entries::iterator> index_;
+};
+
+} // namespace
@@ -0,0 +1,126 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "block_compare.hpp"
+#include "DeltaArray.hpp"
+#include "wire_util.hpp"
+
+namespace cppmpl {
+
+//======================================================================
+DeltaArray::DeltaArray (const std::string &name, size_t rows, size_t cols,
+                        size_t block_size) :
+    name_{name},
+    rows_{rows},
+    cols_{cols},
+    block_size_{block_size},
+    previous_valid_{false},
+    full_{true},
+    sent_full_{false}
+{
+  if (block_size == 0) {
+    throw std::runtime_error("DeltaArray block_size must be positive");
+  }
+}
+
+size_t DeltaArray::Update (const double *data) {
+  const size_t count = rows_ * cols_;
+  sent_full_ = full_ || !previous_valid_;
+  ranges_.clear();
+
+  if (sent_full_) {
+    ranges_.push_back(Range{0, count});
+  } else {
+    for (size_t begin = 0; begin < count; begin += block_size_) {
+      const size_t end = std::min(count, begin + block_size_);
+      if (BlocksEqual(reinterpret_cast<const uint8_t*>(data + begin),
+                      reinterpret_cast<const uint8_t*>(&previous_[begin]),
+                      (end - begin) * sizeof(double))) {
+        continue;
+      }
+      // Adjacent blocks are sent as one range
+      if (!ranges_.empty() && ranges_.back().end == begin) {
+        ranges_.back().end = end;
+      } else {
+        ranges_.push_back(Range{begin, end});
+      }
+    }
+  }
+
+  previous_.resize(count);
+  for (const Range &range : ranges_) {
+    std::memcpy(&previous_[range.begin], data + range.begin,
+                (range.end - range.begin) * sizeof(double));
+  }
+  previous_valid_ = true;
+  return Pack_(data);
+}
+
+size_t DeltaArray::Update (const double *data,
+                           const std::vector<Range> &dirty) {
+  const size_t count = rows_ * cols_;
+  sent_full_ = full_;
+  ranges_.clear();
+
+  if (sent_full_) {
+    ranges_.push_back(Range{0, count});
+  } else {
+    std::vector<Range> sorted{dirty};
+    std::sort(sorted.begin(), sorted.end(),
+              [] (const Range &a, const Range &b) {
+                return a.begin < b.begin;
+              });
+    for (const Range &range : sorted) {
+      if (range.begin > range.end || range.end > count) {
+        throw std::runtime_error("DeltaArray " + name_ +
+                                 " range out of bounds");
+      }
+      if (range.begin == range.end) {
+        continue;
+      }
+      if (!ranges_.empty() && ranges_.back().end >= range.begin) {
+        ranges_.back().end = std::max(ranges_.back().end, range.end);
+      } else {
+        ranges_.push_back(range);
+      }
+    }
+  }
+
+  // Keep the copy current, if there is one, for a later comparing Update
+  if (previous_valid_) {
+    for (const Range &range : ranges_) {
+      std::memcpy(&previous_[range.begin], data + range.begin,
+                  (range.end - range.begin) * sizeof(double));
+    }
+  }
+  return Pack_(data);
+}
+
+size_t DeltaArray::Pack_ (const double *data) {
+  full_ = false;
+  values_.clear();
+  if (sent_full_) {
+    return rows_ * cols_;
+  }
+  for (const Range &range : ranges_) {
+    values_.insert(values_.end(), data + range.begin, data + range.end);
+  }
+  return values_.size();
+}
+
+void DeltaArray::SerializeHeaderTo (std::vector<uint8_t> *buffer) const {
+  buffer->clear();
+  Append(static_cast<uint32_t>(rows_), buffer);
+  Append(static_cast<uint32_t>(cols_), buffer);
+  Append(static_cast<uint8_t>(sent_full_), buffer);
+  buffer->insert(buffer->end(), name_.begin(), name_.end());
+}
+
+} // namespace
@@ -0,0 +1,133 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief A 2D array of doubles that is kept up to date in the iPython
+ * kernel by sending only the ranges that changed.
+ *
+ * The kernel patches the existing numpy array in place, so neither the
+ * bandwidth nor the kernel's work depends on the size of the array, only on
+ * how much of it changed.  Changes are found by comparing blocks against a
+ * copy of the last version sent, or given by the caller, in which case no
+ * copy is kept.
+ *
+ * Usage:
+\code
+    DeltaArray field("Field", rows, cols);
+    mpl.UpdateData(&field, values);            // the whole array
+    while (simulating) {
+      Step(values);
+      mpl.UpdateData(&field, values);          // just the blocks that changed
+    }
+\endcode
+ */
+class DeltaArray {
+public:
+  /// A half-open range of values, counted in row major order.
+  struct Range {
+    uint64_t begin;
+    uint64_t end;
+  };
+
+  //--------------------------------------------------
+  /** \brief Constructs an array associated with a named variable in the
+   * iPython session.
+   *
+   * \param name  the name the array will have in the ipython session.
+   * \param rows  the number of rows.
+   * \param cols  the number of columns.
+   * \param block_size  the number of values compared, and sent, as a unit.
+   */
+  DeltaArray (const std::string &name, size_t rows, size_t cols,
+              size_t block_size = 1024);
+
+  //--------------------------------------------------
+  /** \brief Compares data to the last version sent and packs the blocks
+   * that changed, ready for SerializeHeaderTo, Ranges and Values.
+   *
+   * \param data  rows*cols values in row major order.
+   *
+   * \returns the number of values to be sent.
+   */
+  size_t Update (const double *data);
+
+  //--------------------------------------------------
+  /** \brief Packs the ranges the caller says changed, without comparing.
+   *
+   * \param data  rows*cols values in row major order.
+   * \param dirty  the ranges of data that changed, in any order.
+   *
+   * \returns the number of values to be sent.
+   *
+   * \throws std::runtime_error  if a range is out of bounds.
+   */
+  size_t Update (const double *data, const std::vector<Range> &dirty);
+
+  //--------------------------------------------------
+  /** \brief Forgets the last version sent so the next Update sends every
+   * value.  Use when the kernel may have lost the array.
+   */
+  void Reset (void) { full_ = true; }
+
+  //--------------------------------------------------
+  /** \brief Serializes the shape and update flags for the last Update.
+   *
+   * \param buffer  the byte buffer to be serialized into.  Overwrites
+   *                previous contents.
+   */
+  void SerializeHeaderTo (std::vector<uint8_t> *buffer) const;
+
+  //--------------------------------------------------
+  /** \brief Returns the ranges packed by the last Update, sorted and
+   * merged.
+   */
+  const std::vector<Range>& Ranges (void) const { return ranges_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the values in Ranges, one range after another.  Empty
+   * when the last Update was full, as the data itself is sent then.
+   */
+  const std::vector<double>& Values (void) const { return values_; }
+
+  //--------------------------------------------------
+  /** \brief Returns whether the last Update sent the whole array.
+   */
+  bool IsFull (void) const { return sent_full_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the name of the iPython variable this array is
+   * associated with.
+   */
+  std::string Name (void) const { return name_; }
+
+private:
+  size_t Pack_ (const double *data);
+
+  const std::string name_;
+  const size_t rows_;
+  const size_t cols_;
+  const size_t block_size_;
+
+  // The last version sent, only kept once Update compares, and only valid
+  // while previous_valid_.
+  std::vector<double> previous_;
+  bool previous_valid_;
+
+  bool full_;
+  bool sent_full_;
+  std::vector<Range> ranges_;
+  std::vector<double> values_;
+};
+
+} // namespace
@@ -0,0 +1,178 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#include "DensityGrid.hpp"
+#include "wire_util.hpp"
+
+namespace cppmpl {
+
+// Points are transformed to pixel coordinates in blocks of this many, in a
+// branch free loop the compiler can vectorize, before being scattered.
+static const size_t BLOCK = 256;
+
+//======================================================================
+DensityGrid::DensityGrid (const std::string &name, size_t width,
+                          size_t height, Extent extent, Aggregate aggregate,
+                          size_t threads) :
+    name_{name},
+    width_{width},
+    height_{height},
+    extent_(extent),
+    aggregate_{aggregate},
+    threads_{threads != 0 ? threads
+             : std::max(1u, std::thread::hardware_concurrency())}
+{
+  if (width == 0 || height == 0 ||
+      !(extent.x_max > extent.x_min) || !(extent.y_max > extent.y_min)) {
+    throw std::runtime_error("DensityGrid " + name + " has an empty extent");
+  }
+  Clear();
+}
+
+void DensityGrid::Add (const double *x, const double *y, size_t count) {
+  if (aggregate_ != Aggregate::COUNT) {
+    throw std::runtime_error("DensityGrid " + name_ + " needs values");
+  }
+  Bin_(x, y, nullptr, count);
+}
+
+void DensityGrid::Add (const double *x, const double *y,
+                       const double *values, size_t count) {
+  Bin_(x, y, aggregate_ == Aggregate::COUNT ? nullptr : values, count);
+}
+
+void DensityGrid::Clear (void) {
+  counts_.assign(width_*height_, 0);
+  accum_.assign(aggregate_ == Aggregate::COUNT ? 0 : width_*height_,
+                aggregate_ == Aggregate::MAX
+                ? -std::numeric_limits<double>::infinity() : 0.0);
+}
+
+void DensityGrid::Bin_ (const double *x, const double *y,
+                        const double *values, size_t count) {
+  const size_t pixels = width_*height_;
+  const size_t threads = std::max<size_t>(
+      1, std::min(threads_, count / (16*BLOCK)));
+  const double sx = width_ / (extent_.x_max - extent_.x_min);
+  const double sy = height_ / (extent_.y_max - extent_.y_min);
+  const double x0 = extent_.x_min;
+  const double y0 = extent_.y_min;
+  const double w = static_cast<double>(width_);
+  const double h = static_cast<double>(height_);
+  const Aggregate aggregate = aggregate_;
+
+  // Each thread bins a contiguous slice of the points into its own grid, so
+  // there is no sharing until the reduction.
+  std::vector<std::vector<uint64_t>> counts(threads);
+  std::vector<std::vector<double>> accums(threads);
+  auto bin = [&] (size_t t) {
+    std::vector<uint64_t> &count_grid = counts[t];
+    std::vector<double> &accum_grid = accums[t];
+    count_grid.assign(pixels, 0);
+    if (values) {
+      accum_grid.assign(pixels, aggregate == Aggregate::MAX
+                        ? -std::numeric_limits<double>::infinity() : 0.0);
+    }
+
+    const size_t begin = count * t / threads;
+    const size_t end = count * (t + 1) / threads;
+    double fx[BLOCK];
+    double fy[BLOCK];
+    for (size_t block = begin; block < end; block += BLOCK) {
+      const size_t n = std::min(BLOCK, end - block);
+      const double *bx = x + block;
+      const double *by = y + block;
+      for (size_t i = 0; i < n; ++i) {
+        fx[i] = (bx[i] - x0) * sx;
+        fy[i] = (by[i] - y0) * sy;
+      }
+      for (size_t i = 0; i < n; ++i) {
+        // Written so NaNs fail the test too
+        if (!(fx[i] >= 0.0 && fx[i] < w && fy[i] >= 0.0 && fy[i] < h)) {
+          continue;
+        }
+        const size_t pixel = static_cast<size_t>(fy[i]) * width_
+          + static_cast<size_t>(fx[i]);
+        ++count_grid[pixel];
+        if (!values) {
+          continue;
+        }
+        const double value = values[block + i];
+        if (aggregate == Aggregate::MAX) {
+          accum_grid[pixel] = std::max(accum_grid[pixel], value);
+        } else {
+          accum_grid[pixel] += value;
+        }
+      }
+    }
+  };
+
+  // Reduce the per-thread grids into ours, each thread taking a band of
+  // rows.
+  auto reduce = [&] (size_t t) {
+    const size_t begin = pixels * t / threads;
+    const size_t end = pixels * (t + 1) / threads;
+    for (size_t g = 0; g != threads; ++g) {
+      const uint64_t *count_grid = counts[g].data();
+      for (size_t p = begin; p != end; ++p) {
+        counts_[p] += count_grid[p];
+      }
+      if (!values) {
+        continue;
+      }
+      const double *accum_grid = accums[g].data();
+      if (aggregate == Aggregate::MAX) {
+        for (size_t p = begin; p != end; ++p) {
+          accum_[p] = std::max(accum_[p], accum_grid[p]);
+        }
+      } else {
+        for (size_t p = begin; p != end; ++p) {
+          accum_[p] += accum_grid[p];
+        }
+      }
+    }
+  };
+
+  RunOnThreads(threads, bin);
+  RunOnThreads(threads, reduce);
+}
+
+std::vector<double> DensityGrid::Result (void) const {
+  std::vector<double> result(width_*height_);
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  for (size_t p = 0; p != result.size(); ++p) {
+    switch (aggregate_) {
+    case Aggregate::COUNT:
+      result[p] = static_cast<double>(counts_[p]);
+      break;
+    case Aggregate::MEAN:
+      result[p] = counts_[p] ? accum_[p] / counts_[p] : nan;
+      break;
+    case Aggregate::MAX:
+      result[p] = counts_[p] ? accum_[p] : nan;
+      break;
+    }
+  }
+  return result;
+}
+
+void DensityGrid::SerializeHeaderTo (std::vector<uint8_t> *buffer) const {
+  buffer->clear();
+  Append(static_cast<uint32_t>(width_), buffer);
+  Append(static_cast<uint32_t>(height_), buffer);
+  Append(extent_.x_min, buffer);
+  Append(extent_.x_max, buffer);
+  Append(extent_.y_min, buffer);
+  Append(extent_.y_max, buffer);
+  buffer->insert(buffer->end(), name_.begin(), name_.end());
+}
+
+} // namespace
@@ -0,0 +1,126 @@
+// 
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+// 
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief Aggregates a point cloud onto a fixed pixel grid, datashader
+ * style, so only the grid needs to be sent to the iPython kernel.
+ *
+ * Points are binned in parallel, each thread into its own grid, and the
+ * per-thread grids are then reduced.  The work in the kernel is constant
+ * in the number of points.
+ *
+ * Usage:
+\code
+    DensityGrid density("Density", 800, 600, {x_min, x_max, y_min, y_max});
+    density.Add(xs.data(), ys.data(), xs.size());
+    mpl.SendDensity(density);
+    mpl.RunCode("cpp_ipython_show_density('Density', cmap='inferno')");
+\endcode
+ */
+class DensityGrid {
+public:
+  /// How the points (or their values) falling in a pixel are combined.
+  enum class Aggregate : uint8_t {COUNT, MEAN, MAX};
+
+  /// The data coordinates the grid covers.
+  struct Extent {
+    double x_min;
+    double x_max;
+    double y_min;
+    double y_max;
+  };
+
+  //--------------------------------------------------
+  /** \brief Constructs an empty grid associated with a named variable in the
+   * iPython session.
+   *
+   * \param name  the name the grid will have in the ipython session.
+   * \param width  the number of pixels along x.
+   * \param height  the number of pixels along y.
+   * \param extent  the data range covered.  Points outside are dropped.
+   * \param aggregate  how to combine points falling in the same pixel.
+   * \param threads  the number of threads to bin with, 0 for one per core.
+   */
+  DensityGrid (const std::string &name, size_t width, size_t height,
+               Extent extent, Aggregate aggregate = Aggregate::COUNT,
+               size_t threads = 0);
+
+  //--------------------------------------------------
+  /** \brief Bins points, counting them.  Only valid with Aggregate::COUNT.
+   *
+   * \param x  count x coordinates.
+   * \param y  count y coordinates.
+   * \param count  the number of points.
+   */
+  void Add (const double *x, const double *y, size_t count);
+
+  //--------------------------------------------------
+  /** \brief Bins points with a value channel, which is averaged or maxed
+   * per pixel (or ignored when counting).
+   *
+   * \param x  count x coordinates.
+   * \param y  count y coordinates.
+   * \param values  count values.
+   * \param count  the number of points.
+   */
+  void Add (const double *x, const double *y, const double *values,
+            size_t count);
+
+  //--------------------------------------------------
+  /** \brief Empties the grid.
+   */
+  void Clear (void);
+
+  //--------------------------------------------------
+  /** \brief Returns the aggregated grid, height rows by width columns with
+   * row 0 at y_min.  Pixels with no points are NaN for MEAN and MAX.
+   */
+  std::vector<double> Result (void) const;
+
+  //--------------------------------------------------
+  /** \brief Serializes the geometry and name.  The grid itself is sent from
+   * Result().
+   *
+   * \param buffer  the byte buffer to be serialized into.  Overwrites
+   *                previous contents.
+   */
+  void SerializeHeaderTo (std::vector<uint8_t> *buffer) const;
+
+  size_t Width (void) const { return width_; }
+  size_t Height (void) const { return height_; }
+  const Extent& GetExtent (void) const { return extent_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the name of the iPython variable this grid is associated
+   * with.
+   */
+  std::string Name (void) const { return name_; }
+
+private:
+  void Bin_ (const double *x, const double *y, const double *values,
+             size_t count);
+
+  const std::string name_;
+  const size_t width_;
+  const size_t height_;
+  const Extent extent_;
+  const Aggregate aggregate_;
+  const size_t threads_;
+
+  // Running per-pixel count, and sum or max of values.
+  std::vector<uint64_t> counts_;
+  std::vector<double> accum_;
+};
+
+} // namespace
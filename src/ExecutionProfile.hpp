@@ -0,0 +1,55 @@
+// 
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+// 
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief Where the time went in one profiled RunCode.
+ *
+ * Times other than round_trip_seconds are measured in the kernel, so
+ * round_trip_seconds - wall_seconds - draw_seconds is roughly the cost of
+ * messaging and transport.
+ */
+struct ExecutionProfile {
+  /// One function from the cProfile statistics.
+  struct Function {
+    /// As file:line(function)
+    std::string name;
+    uint64_t calls;
+    /// Time in the function itself, excluding its callees
+    double own_seconds;
+    /// Time in the function including its callees
+    double cumulative_seconds;
+  };
+
+  /// From sending the request to receiving the reply, measured in C++
+  double round_trip_seconds = 0.0;
+
+  /// Running the code, wall clock and CPU time of the kernel process
+  double wall_seconds = 0.0;
+  double cpu_seconds = 0.0;
+
+  /// Redrawing the matplotlib figures the code changed
+  double draw_seconds = 0.0;
+
+  /// Peak traced allocation above the starting level while the code ran,
+  /// or -1 unless memory tracing was asked for in SetProfiling and the
+  /// kernel can trace allocations (Python 3.4 on).  Tracing every
+  /// allocation can slow allocation heavy code several times over, and the
+  /// times above include that, so profile without it to time the code.
+  int64_t peak_memory_bytes = -1;
+
+  /// The top functions by cumulative time, if requested
+  std::vector<Function> functions;
+};
+
+} // namespace
@@ -0,0 +1,101 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "block_compare.hpp"
+#include "ImageStream.hpp"
+#include "wire_util.hpp"
+
+namespace cppmpl {
+
+//======================================================================
+ImageStream::ImageStream (const std::string &name, size_t width,
+                          size_t height, size_t channels, PixelType type,
+                          size_t tile_size) :
+    name_{name},
+    width_{width},
+    height_{height},
+    channels_{channels},
+    type_{type},
+    tile_size_{tile_size},
+    tiles_x_{(width + tile_size - 1) / tile_size},
+    tiles_y_{(height + tile_size - 1) / tile_size},
+    tile_row_bytes_{tile_size * channels * static_cast<size_t>(type)},
+    previous_(tiles_x_ * tiles_y_ * tile_size * tile_row_bytes_, 0),
+    full_{true},
+    sent_full_{false}
+{
+  if (channels != 1 && channels != 3 && channels != 4) {
+    throw std::runtime_error("ImageStream needs 1, 3 or 4 channels");
+  }
+  if (tile_size == 0) {
+    throw std::runtime_error("ImageStream tile_size must be positive");
+  }
+}
+
+size_t ImageStream::Update (const void *pixels) {
+  const uint8_t *frame = static_cast<const uint8_t*>(pixels);
+  const size_t pixel_bytes = channels_ * static_cast<size_t>(type_);
+  const size_t frame_row_bytes = width_ * pixel_bytes;
+  const size_t padded_row_bytes = tiles_x_ * tile_row_bytes_;
+  const size_t tile_bytes = tile_size_ * tile_row_bytes_;
+
+  sent_full_ = full_;
+  dirty_.clear();
+  tiles_.clear();
+
+  for (size_t ty = 0; ty != tiles_y_; ++ty) {
+    const size_t y0 = ty * tile_size_;
+    const size_t rows = std::min(tile_size_, height_ - y0);
+    for (size_t tx = 0; tx != tiles_x_; ++tx) {
+      const size_t x_offset = tx * tile_row_bytes_;
+      const size_t row_bytes = std::min(tile_row_bytes_,
+                                        frame_row_bytes - x_offset);
+
+      // Compare row by row against the padded copy of the last frame
+      bool changed = full_;
+      for (size_t y = 0; y != rows && !changed; ++y) {
+        changed = !BlocksEqual(
+            frame + (y0 + y) * frame_row_bytes + x_offset,
+            previous_.data() + (y0 + y) * padded_row_bytes + x_offset,
+            row_bytes);
+      }
+      if (!changed) {
+        continue;
+      }
+
+      // Pack the tile, zero padded, and remember it as the previous frame
+      dirty_.push_back(static_cast<uint32_t>(ty * tiles_x_ + tx));
+      tiles_.resize(tiles_.size() + tile_bytes, 0);
+      uint8_t *tile = &tiles_[tiles_.size() - tile_bytes];
+      for (size_t y = 0; y != rows; ++y) {
+        const uint8_t *src = frame + (y0 + y) * frame_row_bytes + x_offset;
+        std::memcpy(tile + y * tile_row_bytes_, src, row_bytes);
+        std::memcpy(previous_.data() + (y0 + y) * padded_row_bytes + x_offset,
+                    src, row_bytes);
+      }
+    }
+  }
+
+  full_ = false;
+  return dirty_.size();
+}
+
+void ImageStream::SerializeHeaderTo (std::vector<uint8_t> *buffer) const {
+  buffer->clear();
+  Append(static_cast<uint32_t>(width_), buffer);
+  Append(static_cast<uint32_t>(height_), buffer);
+  Append(static_cast<uint32_t>(tile_size_), buffer);
+  Append(static_cast<uint8_t>(channels_), buffer);
+  Append(static_cast<uint8_t>(type_), buffer);
+  Append(static_cast<uint8_t>(sent_full_), buffer);
+  buffer->insert(buffer->end(), name_.begin(), name_.end());
+}
+
+} // namespace
@@ -0,0 +1,125 @@
+// 
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+// 
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief A stream of fixed size mono, RGB or RGBA frames that is sent to
+ * the iPython kernel as delta updates.
+ *
+ * Each frame is compared to the previous one in square tiles and only the
+ * tiles that changed are sent.  The kernel patches a persistent buffer in
+ * place and, if the stream is being shown, updates the AxesImage, so
+ * bandwidth scales with how much of the scene changes.
+ *
+ * Usage:
+\code
+    ImageStream camera("Camera", 640, 480, 3, ImageStream::PixelType::UINT8);
+    mpl.SendFrame(&camera, first_frame);
+    mpl.RunCode("cpp_ipython_show_stream('Camera')");
+    while (running) {
+      mpl.SendFrame(&camera, next_frame);
+    }
+\endcode
+ */
+class ImageStream {
+public:
+  /// The type of each channel of a pixel.
+  enum class PixelType : uint8_t {UINT8 = 1, UINT16 = 2};
+
+  //--------------------------------------------------
+  /** \brief Constructs a stream associated with a named variable in the
+   * iPython session.
+   *
+   * \param name  the name the image array will have in the ipython session.
+   * \param width  frame width in pixels.
+   * \param height  frame height in pixels.
+   * \param channels  1 for mono, 3 for RGB or 4 for RGBA.
+   * \param type  the type of each channel.
+   * \param tile_size  the width and height of the tiles frames are compared
+   *                   and sent in.
+   */
+  ImageStream (const std::string &name, size_t width, size_t height,
+               size_t channels, PixelType type, size_t tile_size = 32);
+
+  //--------------------------------------------------
+  /** \brief Compares a frame to the previous one and packs the tiles that
+   * changed, ready for SerializeHeaderTo, TileIndices and TileData.
+   *
+   * \param pixels  the frame, row major with interleaved channels and no
+   *                padding between rows.
+   *
+   * \returns the number of tiles that changed.
+   */
+  size_t Update (const void *pixels);
+
+  //--------------------------------------------------
+  /** \brief Forgets the previous frame so the next Update sends every tile.
+   * Use when the kernel may have lost the persistent buffer.
+   */
+  void Reset (void) { full_ = true; }
+
+  //--------------------------------------------------
+  /** \brief Serializes the stream geometry and update flags for the last
+   * Update.
+   *
+   * \param buffer  the byte buffer to be serialized into.  Overwrites
+   *                previous contents.
+   */
+  void SerializeHeaderTo (std::vector<uint8_t> *buffer) const;
+
+  //--------------------------------------------------
+  /** \brief Returns the uint32 indices, row major, of the tiles packed by the
+   * last Update.
+   */
+  const std::vector<uint32_t>& TileIndices (void) const { return dirty_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the changed tiles from the last Update, each
+   * tile_size*tile_size pixels, zero padded at the right and bottom edges.
+   */
+  const std::vector<uint8_t>& TileData (void) const { return tiles_; }
+
+  //--------------------------------------------------
+  /** \brief Returns whether the last Update sent the whole frame.
+   */
+  bool IsFullFrame (void) const { return sent_full_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the name of the iPython variable this stream is
+   * associated with.
+   */
+  std::string Name (void) const { return name_; }
+
+private:
+  const std::string name_;
+  const size_t width_;
+  const size_t height_;
+  const size_t channels_;
+  const PixelType type_;
+  const size_t tile_size_;
+  const size_t tiles_x_;
+  const size_t tiles_y_;
+
+  // Bytes in one row of one tile.
+  const size_t tile_row_bytes_;
+
+  // The previous frame, padded to a whole number of tiles.
+  std::vector<uint8_t> previous_;
+
+  bool full_;
+  bool sent_full_;
+  std::vector<uint32_t> dirty_;
+  std::vector<uint8_t> tiles_;
+};
+
+} // namespace
@@ -0,0 +1,88 @@
+// 
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+// 
+
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief Unbounded lock-free multi-producer single-consumer FIFO queue.
+ *
+ * This is Dmitry Vyukov's intrusive MPSC queue: Push is one atomic exchange
+ * plus one store and never waits on other producers or the consumer.  Each
+ * producer's items come out in the order it pushed them.  Only one thread
+ * may call Pop and Empty.
+ *
+ * T must be default constructible and movable.
+ */
+template <typename T>
+class MpscQueue {
+public:
+  MpscQueue (void) : head_{new Node}, tail_{head_.load()} {}
+
+  ~MpscQueue (void) {
+    T value;
+    while (Pop(&value)) {}
+    delete tail_;
+  }
+
+  MpscQueue (const MpscQueue&) = delete;
+  MpscQueue& operator= (const MpscQueue&) = delete;
+
+  //--------------------------------------------------
+  /** \brief Appends a value.  Safe to call from any number of threads.
+   */
+  void Push (T value) {
+    Node *node = new Node;
+    node->value = std::move(value);
+    Node *previous = head_.exchange(node, std::memory_order_acq_rel);
+    // seq_cst rather than release so that a consumer checking Empty before
+    // going to sleep and a producer checking whether to wake it cannot both
+    // miss each other.
+    previous->next.store(node, std::memory_order_seq_cst);
+  }
+
+  //--------------------------------------------------
+  /** \brief Removes the oldest value.  Consumer thread only.
+   *
+   * \returns false if the queue was empty.
+   */
+  bool Pop (T *value) {
+    Node *next = tail_->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return false;
+    }
+    *value = std::move(next->value);
+    delete tail_;
+    tail_ = next;
+    return true;
+  }
+
+  //--------------------------------------------------
+  /** \brief Returns whether there is nothing to Pop.  Consumer thread only.
+   * A Push that is still in progress may not be visible yet.
+   */
+  bool Empty (void) const {
+    return tail_->next.load(std::memory_order_seq_cst) == nullptr;
+  }
+
+private:
+  struct Node {
+    Node (void) : next{nullptr} {}
+    std::atomic<Node*> next;
+    T value;
+  };
+
+  // Producers append after head_, the consumer pops after tail_, which is
+  // always a node whose value has already been taken.
+  std::atomic<Node*> head_;
+  Node *tail_;
+};
+
+} // namespace
@@ -0,0 +1,326 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "QuantizedArray.hpp"
+#include "wire_util.hpp"
+
+namespace cppmpl {
+
+// Codes per step of the integer encodings.  The largest code marks NaN.
+static const uint32_t UINT8_LEVELS = 254;
+static const uint32_t UINT16_LEVELS = 65534;
+
+// float16 chunks are scaled so their largest magnitude is in [2^14, 2^15)
+static const int FLOAT16_EXPONENT = 14;
+
+// The smallest and largest finite value, or 0 and 0 if there are none.
+static void FiniteRange (const double *x, size_t count,
+                         double *lo, double *hi) {
+  const double inf = std::numeric_limits<double>::infinity();
+  double low = inf;
+  double high = -inf;
+  size_t i = 0;
+#ifdef __SSE2__
+  // Non-finite lanes are replaced by infinities that cannot win
+  const __m128d vinf = _mm_set1_pd(inf);
+  const __m128d vninf = _mm_set1_pd(-inf);
+  const __m128d abs_mask = _mm_castsi128_pd(
+      _mm_set1_epi64x(0x7fffffffffffffffLL));
+  __m128d vlow = vinf;
+  __m128d vhigh = vninf;
+  for (; i + 2 <= count; i += 2) {
+    const __m128d v = _mm_loadu_pd(x + i);
+    const __m128d finite = _mm_cmplt_pd(_mm_and_pd(v, abs_mask), vinf);
+    const __m128d kept = _mm_and_pd(finite, v);
+    vlow = _mm_min_pd(vlow, _mm_or_pd(kept, _mm_andnot_pd(finite, vinf)));
+    vhigh = _mm_max_pd(vhigh, _mm_or_pd(kept, _mm_andnot_pd(finite, vninf)));
+  }
+  double lows[2], highs[2];
+  _mm_storeu_pd(lows, vlow);
+  _mm_storeu_pd(highs, vhigh);
+  low = std::min(lows[0], lows[1]);
+  high = std::max(highs[0], highs[1]);
+#endif
+  for (; i < count; ++i) {
+    if (std::isfinite(x[i])) {
+      low = std::min(low, x[i]);
+      high = std::max(high, x[i]);
+    }
+  }
+  if (low > high) {
+    low = high = 0.0;
+  }
+  *lo = low;
+  *hi = high;
+}
+
+#ifdef __SSE2__
+// Codes of four values, rounded to nearest, with nan_code in place of
+// non-finite values.
+static inline __m128i Codes4 (const double *x, __m128d offset,
+                              __m128d inverse, __m128i nan_code) {
+  const __m128d vinf = _mm_set1_pd(std::numeric_limits<double>::infinity());
+  const __m128d abs_mask = _mm_castsi128_pd(
+      _mm_set1_epi64x(0x7fffffffffffffffLL));
+  const __m128d a = _mm_loadu_pd(x);
+  const __m128d b = _mm_loadu_pd(x + 2);
+  const __m128i codes = _mm_unpacklo_epi64(
+      _mm_cvtpd_epi32(_mm_mul_pd(_mm_sub_pd(a, offset), inverse)),
+      _mm_cvtpd_epi32(_mm_mul_pd(_mm_sub_pd(b, offset), inverse)));
+  // Narrow the 64 bit comparison masks to 32 bit lanes
+  const __m128i finite_a = _mm_shuffle_epi32(_mm_castpd_si128(
+      _mm_cmplt_pd(_mm_and_pd(a, abs_mask), vinf)), _MM_SHUFFLE(2, 0, 2, 0));
+  const __m128i finite_b = _mm_shuffle_epi32(_mm_castpd_si128(
+      _mm_cmplt_pd(_mm_and_pd(b, abs_mask), vinf)), _MM_SHUFFLE(2, 0, 2, 0));
+  const __m128i finite = _mm_unpacklo_epi64(finite_a, finite_b);
+  return _mm_or_si128(_mm_and_si128(finite, codes),
+                      _mm_andnot_si128(finite, nan_code));
+}
+#endif
+
+template <typename T>
+static void QuantizeInts (const double *x, size_t count, double offset,
+                          double inverse, T *out) {
+  const T nan_code = std::numeric_limits<T>::max();
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128d voffset = _mm_set1_pd(offset);
+  const __m128d vinverse = _mm_set1_pd(inverse);
+  if (sizeof(T) == 1) {
+    const __m128i vnan = _mm_set1_epi32(nan_code);
+    for (; i + 16 <= count; i += 16) {
+      const __m128i low = _mm_packs_epi32(
+          Codes4(x + i, voffset, vinverse, vnan),
+          Codes4(x + i + 4, voffset, vinverse, vnan));
+      const __m128i high = _mm_packs_epi32(
+          Codes4(x + i + 8, voffset, vinverse, vnan),
+          Codes4(x + i + 12, voffset, vinverse, vnan));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                       _mm_packus_epi16(low, high));
+    }
+  } else {
+    // SSE2 only packs to signed 16 bits, so pack relative to 32768
+    const __m128i vnan = _mm_set1_epi32(nan_code);
+    const __m128i bias = _mm_set1_epi32(32768);
+    const __m128i flip = _mm_set1_epi16(static_cast<int16_t>(0x8000));
+    for (; i + 8 <= count; i += 8) {
+      const __m128i packed = _mm_packs_epi32(
+          _mm_sub_epi32(Codes4(x + i, voffset, vinverse, vnan), bias),
+          _mm_sub_epi32(Codes4(x + i + 4, voffset, vinverse, vnan), bias));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                       _mm_xor_si128(packed, flip));
+    }
+  }
+#endif
+  for (; i < count; ++i) {
+    out[i] = std::isfinite(x[i])
+        ? static_cast<T>(std::nearbyint((x[i] - offset) * inverse))
+        : nan_code;
+  }
+}
+
+// Rounds to the nearest float16, as the F16C instructions do.
+static uint16_t ToHalf (float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const uint16_t sign = (bits >> 16) & 0x8000;
+  const uint32_t magnitude = bits & 0x7fffffff;
+  if (magnitude > 0x7f800000) {
+    return sign | 0x7e00;
+  }
+  if (magnitude >= 0x477ff000) {
+    // At or above halfway from 65504 to the next power of two
+    return sign | 0x7c00;
+  }
+  if (magnitude < 0x38800000) {
+    // Subnormal, in units of 2^-24
+    float subnormal;
+    std::memcpy(&subnormal, &magnitude, sizeof(subnormal));
+    return sign | static_cast<uint16_t>(std::nearbyint(subnormal * 16777216.0f));
+  }
+  // Rebias the exponent and round the mantissa to even
+  uint32_t half = (magnitude - 0x38000000) >> 13;
+  const uint32_t rest = magnitude & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    ++half;
+  }
+  return sign | static_cast<uint16_t>(half);
+}
+
+static void QuantizeHalves (const double *x, size_t count, double inverse,
+                            uint16_t *out) {
+  size_t i = 0;
+#ifdef __F16C__
+  const __m128d vinverse = _mm_set1_pd(inverse);
+  for (; i + 4 <= count; i += 4) {
+    const __m128 floats = _mm_movelh_ps(
+        _mm_cvtpd_ps(_mm_mul_pd(_mm_loadu_pd(x + i), vinverse)),
+        _mm_cvtpd_ps(_mm_mul_pd(_mm_loadu_pd(x + i + 2), vinverse)));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i),
+                     _mm_cvtps_ph(floats, _MM_FROUND_TO_NEAREST_INT));
+  }
+#endif
+  for (; i < count; ++i) {
+    out[i] = ToHalf(static_cast<float>(x[i] * inverse));
+  }
+}
+
+static void QuantizeFloats (const double *x, size_t count, float *out) {
+  size_t i = 0;
+#ifdef __SSE2__
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_ps(out + i, _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(x + i)),
+                                         _mm_cvtpd_ps(_mm_loadu_pd(x + i + 2))));
+  }
+#endif
+  for (; i < count; ++i) {
+    out[i] = static_cast<float>(x[i]);
+  }
+}
+
+//======================================================================
+QuantizedArray::Precision QuantizedArray::Precision::AbsoluteError (
+    double max_error) {
+  if (!(max_error > 0.0) || !std::isfinite(max_error)) {
+    throw std::runtime_error("QuantizedArray error bound must be positive");
+  }
+  return Precision{max_error, 0};
+}
+
+QuantizedArray::Precision QuantizedArray::Precision::SignificantBits (
+    int bits) {
+  if (bits < 1) {
+    throw std::runtime_error("QuantizedArray needs at least one bit");
+  }
+  return Precision{0.0, bits};
+}
+
+//======================================================================
+QuantizedArray::QuantizedArray (const std::string &name, const double *data,
+                                size_t rows, size_t cols,
+                                Precision precision, size_t chunk_size) :
+    name_{name},
+    precision_(precision),
+    chunk_size_{chunk_size},
+    encoding_{Encoding::FLOAT64},
+    rows_{0},
+    cols_{0}
+{
+  if (chunk_size == 0) {
+    throw std::runtime_error("QuantizedArray chunk size must be positive");
+  }
+  SetData(data, rows, cols);
+}
+
+void QuantizedArray::SetData (const double *data, size_t rows, size_t cols) {
+  rows_ = rows;
+  cols_ = cols;
+  const size_t count = rows * cols;
+  const size_t chunks = (count + chunk_size_ - 1) / chunk_size_;
+  params_.resize(2 * chunks);
+
+  auto chunk_count = [&] (size_t chunk) {
+    return std::min(chunk_size_, count - chunk * chunk_size_);
+  };
+
+  if (precision_.bits == 0) {
+    // Narrowest integer codes that meet the bound in the widest chunk.
+    // Rounding is off by at most half a step.
+    double widest = 0.0;
+    for (size_t c = 0; c < chunks; ++c) {
+      FiniteRange(data + c * chunk_size_, chunk_count(c),
+                  &params_[2*c], &params_[2*c + 1]);
+      widest = std::max(widest, params_[2*c + 1] - params_[2*c]);
+    }
+    uint32_t levels = 0;
+    if (widest <= 2.0 * precision_.max_error * UINT8_LEVELS) {
+      encoding_ = Encoding::UINT8;
+      levels = UINT8_LEVELS;
+    } else if (widest <= 2.0 * precision_.max_error * UINT16_LEVELS) {
+      encoding_ = Encoding::UINT16;
+      levels = UINT16_LEVELS;
+    } else {
+      encoding_ = Encoding::FLOAT64;
+    }
+
+    if (levels != 0) {
+      codes_.resize(count * (encoding_ == Encoding::UINT8 ? 1 : 2));
+      for (size_t c = 0; c < chunks; ++c) {
+        const double offset = params_[2*c];
+        const double range = params_[2*c + 1] - offset;
+        const double scale = range > 0.0 ? range / levels : 1.0;
+        params_[2*c + 1] = scale;
+        const double *x = data + c * chunk_size_;
+        if (encoding_ == Encoding::UINT8) {
+          QuantizeInts(x, chunk_count(c), offset, 1.0 / scale,
+                       codes_.data() + c * chunk_size_);
+        } else {
+          QuantizeInts(x, chunk_count(c), offset, 1.0 / scale,
+                       reinterpret_cast<uint16_t*>(codes_.data()) +
+                       c * chunk_size_);
+        }
+      }
+      return;
+    }
+  } else if (precision_.bits <= 11) {
+    encoding_ = Encoding::FLOAT16;
+    codes_.resize(count * sizeof(uint16_t));
+    for (size_t c = 0; c < chunks; ++c) {
+      const double *x = data + c * chunk_size_;
+      double lo, hi;
+      FiniteRange(x, chunk_count(c), &lo, &hi);
+      const double largest = std::max(std::fabs(lo), std::fabs(hi));
+      int exponent = largest > 0.0 ? std::ilogb(largest) - FLOAT16_EXPONENT
+                                   : 0;
+      exponent = std::max(exponent, -1000);
+      params_[2*c] = 0.0;
+      params_[2*c + 1] = std::ldexp(1.0, exponent);
+      QuantizeHalves(x, chunk_count(c), std::ldexp(1.0, -exponent),
+                     reinterpret_cast<uint16_t*>(codes_.data()) +
+                     c * chunk_size_);
+    }
+    return;
+  } else if (precision_.bits <= 24) {
+    encoding_ = Encoding::FLOAT32;
+    codes_.resize(count * sizeof(float));
+    QuantizeFloats(data, count, reinterpret_cast<float*>(codes_.data()));
+  } else {
+    encoding_ = Encoding::FLOAT64;
+  }
+
+  // Floats need no offset or scale
+  for (size_t c = 0; c < chunks; ++c) {
+    params_[2*c] = 0.0;
+    params_[2*c + 1] = 1.0;
+  }
+  if (encoding_ == Encoding::FLOAT64) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(data);
+    codes_.assign(bytes, bytes + count * sizeof(double));
+  }
+}
+
+void QuantizedArray::SerializeHeaderTo (std::vector<uint8_t> *buffer) const {
+  buffer->clear();
+  Append(rows_, buffer);
+  Append(cols_, buffer);
+  Append(static_cast<uint8_t>(encoding_), buffer);
+  Append(static_cast<uint32_t>(chunk_size_), buffer);
+  buffer->insert(buffer->end(), name_.begin(), name_.end());
+}
+
+} // namespace
@@ -0,0 +1,135 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief A 2D array of doubles quantized to a stated precision, for data
+ * that is only going to be plotted.
+ *
+ * The array is split into chunks, and each chunk is sent as 8 or 16 bit
+ * codes with its own offset and scale, or as float16 or float32.  In the
+ * iPython session it becomes an ordinary float64 array of the dequantized
+ * values.  NaN survives every encoding.  The integer encodings cannot hold
+ * infinities, so they arrive as NaN.
+ *
+ * Usage:
+\code
+    // Good to a micrometre, which nobody will see on a plot of metres
+    QuantizedArray track("Track", positions.data(), count, 3,
+                         QuantizedArray::Precision::AbsoluteError(1e-6));
+    mpl.SendQuantized(track);
+    mpl.RunCode("plot(Track[:, 0], Track[:, 1])");
+\endcode
+ */
+class QuantizedArray {
+public:
+  /// How the values travel.  The integer codes reserve their largest value
+  /// for NaN.
+  enum class Encoding : uint8_t {UINT8, UINT16, FLOAT16, FLOAT32, FLOAT64};
+
+  /// The precision the receiver needs.
+  struct Precision {
+    //--------------------------------------------------
+    /** \brief No value may be off by more than max_error.  Uses the
+     * narrowest integer codes that achieve it in every chunk, or sends the
+     * values as they are if even 16 bits are not enough.
+     */
+    static Precision AbsoluteError (double max_error);
+
+    //--------------------------------------------------
+    /** \brief Keeps this many significant bits of every value: float16 for
+     * up to 11 bits, float32 for up to 24, otherwise the values as they
+     * are.  float16 chunks are scaled by a power of two to fit its range,
+     * so only values 2^28 times smaller than the largest in their chunk
+     * lose precision.
+     */
+    static Precision SignificantBits (int bits);
+
+    double max_error;
+    int bits;
+  };
+
+  //--------------------------------------------------
+  /** \brief Quantizes an array associated with a named variable in the
+   * iPython session.
+   *
+   * \param name  the name the array will have in the ipython session.
+   * \param data  pointer to rows*cols values in row major order.
+   * \param rows  the number of rows in data.
+   * \param cols  the number of columns in data.
+   * \param precision  from Precision::AbsoluteError or
+   *                   Precision::SignificantBits.
+   * \param chunk_size  the number of values sharing an offset and scale.
+   *
+   * \throws std::runtime_error  if the precision or chunk size is invalid.
+   */
+  QuantizedArray (const std::string &name, const double *data,
+                  size_t rows, size_t cols, Precision precision,
+                  size_t chunk_size = 4096);
+
+  //--------------------------------------------------
+  /** \brief Quantizes new contents, reusing this array's buffers.
+   *
+   * \param data  pointer to rows*cols values in row major order.
+   * \param rows  the number of rows in data.
+   * \param cols  the number of columns in data.
+   */
+  void SetData (const double *data, size_t rows, size_t cols);
+
+  //--------------------------------------------------
+  /** \brief Serializes the shape, encoding, chunk size and name.  The
+   * chunk parameters and codes are sent as they are, see Params and Codes.
+   *
+   * \param buffer  the byte buffer to be serialized into.  Overwrites
+   *                previous contents.
+   */
+  void SerializeHeaderTo (std::vector<uint8_t> *buffer) const;
+
+  //--------------------------------------------------
+  /** \brief Returns the offset and scale of each chunk, interleaved.  A
+   * value is code * scale + offset.
+   */
+  const std::vector<double>& Params (void) const { return params_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the encoded values.
+   */
+  const std::vector<uint8_t>& Codes (void) const { return codes_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the encoding chosen for the current contents.
+   */
+  Encoding GetEncoding (void) const { return encoding_; }
+
+  uint32_t Rows (void) const { return rows_; }
+  uint32_t Cols (void) const { return cols_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the name of the iPython variable this array is
+   * associated with.
+   */
+  std::string Name (void) const { return name_; }
+
+private:
+  const std::string name_;
+  const Precision precision_;
+  const size_t chunk_size_;
+  Encoding encoding_;
+  uint32_t rows_;
+  uint32_t cols_;
+
+  std::vector<double> params_;
+  std::vector<uint8_t> codes_;
+};
+
+} // namespace
@@ -4,18 +4,85 @@
 // full text in LICENSE file in root folder of this project.
 //
 
+#include <algorithm>
+#include <random>
 #include <stdexcept>
 
 #include "RequestSink.hpp"
 
 namespace cppmpl {
 
-RequestSink::RequestSink(const std::string &url) :
-      context_{1},
+void ConfigureSocket(const TransportOptions &options, zmq::socket_t *socket) {
+  socket->setsockopt(ZMQ_SNDHWM, &options.send_hwm, sizeof(int));
+  socket->setsockopt(ZMQ_RCVHWM, &options.receive_hwm, sizeof(int));
+  if (options.send_buffer > 0) {
+    socket->setsockopt(ZMQ_SNDBUF, &options.send_buffer, sizeof(int));
+  }
+  if (options.receive_buffer > 0) {
+    socket->setsockopt(ZMQ_RCVBUF, &options.receive_buffer, sizeof(int));
+  }
+  const int keepalive = options.tcp_keepalive ? 1 : 0;
+  socket->setsockopt(ZMQ_TCP_KEEPALIVE, &keepalive, sizeof(int));
+}
+
+//======================================================================
+DataChannel::DataChannel (void) :
+    chunk_bytes_{0},
+    transfer_id_{std::random_device{}()}
+{
+  transfer_id_ = transfer_id_ << 32 | std::random_device{}();
+}
+
+std::vector<zmq::message_t> DataChannel::Request (
+    const std::vector<Frame> &frames) {
+  static const std::string STAGE{"stage"};
+  static const std::string STAGED{"staged"};
+  static const std::string EMPTY;
+
+  // Stage each large frame as [transfer id, frame size, offset] plus a
+  // chunk, and note its id in place of the frame.
+  std::vector<uint64_t> ids(frames.size(), 0);
+  bool staged = false;
+  for (size_t i = 0; i != frames.size(); ++i) {
+    const size_t size = frames[i].size;
+    if (chunk_bytes_ == 0 || size <= chunk_bytes_) {
+      continue;
+    }
+    if (++transfer_id_ == 0) {
+      ++transfer_id_;
+    }
+    const uint8_t *data = static_cast<const uint8_t*>(frames[i].data);
+    for (size_t offset = 0; offset < size; offset += chunk_bytes_) {
+      const uint64_t header[3] = {transfer_id_, size, offset};
+      Transmit_({STAGE, Frame{header, sizeof(header)},
+                 Frame{data + offset, std::min(chunk_bytes_, size - offset)}});
+    }
+    ids[i] = transfer_id_;
+    staged = true;
+  }
+  if (!staged) {
+    return Transmit_(frames);
+  }
+
+  // Then the request itself, with staged frames left empty
+  std::vector<Frame> request{STAGED,
+                             Frame{ids.data(), ids.size()*sizeof(uint64_t)}};
+  for (size_t i = 0; i != frames.size(); ++i) {
+    request.push_back(ids[i] != 0 ? Frame{EMPTY} : frames[i]);
+  }
+  return Transmit_(request);
+}
+
+//======================================================================
+RequestSink::RequestSink(const std::string &url,
+                         const TransportOptions &options) :
+      context_{options.io_threads},
       socket_{context_, ZMQ_REQ},
       url_{url},
       connected_{false}
-{}
+{
+  ConfigureSocket(options, &socket_);
+}
 
 bool RequestSink::Send(const std::string &buffer) {
   std::vector<uint8_t> byte_buffer(buffer.begin(), buffer.end());
@@ -23,18 +90,35 @@ bool RequestSink::Send(const std::string &buffer) {
 }
 
 bool RequestSink::Send(const std::vector<uint8_t> &buffer) {
-  zmq::message_t request((void*)&buffer[0], buffer.size(), nullptr);
-  socket_.send(request);
+  Request({buffer});
+  return true;
+}
 
-  // Get the reply
-  zmq::message_t reply;
-  socket_.recv(&reply);
-  std::string value{reinterpret_cast<char*>(reply.data()), reply.size()};
+std::vector<zmq::message_t> RequestSink::Transmit_(
+    const std::vector<Frame> &frames) {
+  for (size_t i = 0; i != frames.size(); ++i) {
+    zmq::message_t request(const_cast<void*>(frames[i].data), frames[i].size,
+                           nullptr);
+    socket_.send(request, i + 1 != frames.size() ? ZMQ_SNDMORE : 0);
+  }
+
+  // Get the reply, status first
+  zmq::message_t status;
+  socket_.recv(&status);
+  std::vector<zmq::message_t> reply;
+  bool more = status.more();
+  while (more) {
+    reply.emplace_back();
+    socket_.recv(&reply.back());
+    more = reply.back().more();
+  }
+
+  std::string value{reinterpret_cast<char*>(status.data()), status.size()};
   if (value != "Success") {
-    std::runtime_error(value.c_str());
+    throw std::runtime_error(value);
   }
 
-  return true;
+  return reply;
 }
 
 bool RequestSink::Connect(void) {
@@ -6,13 +6,86 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
 #include <zmq.hpp>
 
+#include "TransportOptions.hpp"
+
 namespace cppmpl {
 
+//======================================================================
+/** \brief A borrowed, contiguous chunk of bytes to be sent as one frame of a
+ * multipart message.  The bytes must outlive the call they are passed to.
+ */
+struct Frame {
+  Frame (const void *frame_data, size_t frame_size)
+    : data{frame_data}, size{frame_size} {}
+  Frame (const std::string &buffer)
+    : data{buffer.data()}, size{buffer.size()} {}
+  Frame (const std::vector<uint8_t> &buffer)
+    : data{buffer.data()}, size{buffer.size()} {}
+
+  const void *data;
+  size_t size;
+};
+
+//--------------------------------------------------
+/** \brief Applies the high water marks, buffer sizes and keepalive of
+ * options to a socket.  Must be called before the socket connects.
+ */
+void ConfigureSocket(const TransportOptions &options, zmq::socket_t *socket);
+
+
+//======================================================================
+/** \brief The path binary data takes to the kernel: either a RequestSink to
+ * the listener thread, or a CommChannel over the shell socket.
+ */
+class DataChannel {
+public:
+  DataChannel (void);
+  virtual ~DataChannel (void) {}
+
+  //--------------------------------------------------
+  /** \brief Transmits a multipart request and returns the reply.
+   *
+   * The first reply frame is a status which must be "Success", otherwise it
+   * is the error message from the other end.  The frames are sent without
+   * copying.  Frames larger than the chunk size go ahead of the request in
+   * chunks, each its own round trip, so the kernel can serve other requests
+   * in between.
+   *
+   * \param frames  the frames to send, typically a command name followed by
+   *                its arguments.
+   *
+   * \throws std::runtime_error  if the other end reports a failure.
+   *
+   * \returns the reply frames that followed the status frame.
+   */
+  std::vector<zmq::message_t> Request (const std::vector<Frame> &frames);
+
+  //--------------------------------------------------
+  /** \brief Sets the size in bytes above which frames are sent in chunks, 0
+   * to always send them whole.
+   */
+  void SetChunkSize (size_t chunk_bytes) { chunk_bytes_ = chunk_bytes; }
+
+private:
+  //--------------------------------------------------
+  /** \brief Transmits a request in one message, as Request.
+   */
+  virtual std::vector<zmq::message_t> Transmit_ (
+      const std::vector<Frame> &frames) = 0;
+
+  size_t chunk_bytes_;
+  // Identifies the frame chunks belong to.  Random to start with, as the
+  // kernel may stage frames from several processes through a Broker.
+  uint64_t transfer_id_;
+};
+
+
 //======================================================================
 /** \brief This class wraps a ZeroMQ request-response socket connection.
  *
@@ -26,15 +99,17 @@ namespace cppmpl {
     conn.Send("oh my goodness!");
 \endcode
  */
-class RequestSink {
+class RequestSink : public DataChannel {
 public:
   //--------------------------------------------------
   /** \brief Initializes for a connection to a valid ZeroMQ endpoint, but does
    * not actually connect to it.
    *
    * \param url  the ZeroMQ url to connect to.
+   * \param options  socket settings for the connection.
    */
-  RequestSink(const std::string &url);
+  RequestSink(const std::string &url,
+              const TransportOptions &options = TransportOptions{});
 
   //--------------------------------------------------
   /** \brief Transmits a string.
@@ -60,6 +135,9 @@ public:
   bool Connect(void);
 
 private:
+  std::vector<zmq::message_t> Transmit_(
+      const std::vector<Frame> &frames) override;
+
   zmq::context_t context_;
   zmq::socket_t socket_;
   const std::string url_;
@@ -0,0 +1,146 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#include "SeriesPyramid.hpp"
+#include "wire_util.hpp"
+
+namespace cppmpl {
+
+// Samples per block at level 1, and blocks combined per level above it
+static const size_t BASE_BLOCK = 64;
+static const size_t FANOUT = 4;
+
+// Level 1 blocks below which building is not worth spreading over threads
+static const size_t PARALLEL_BLOCKS = 4096;
+
+// The range of lo[begin, end) and hi[begin, end), skipping NaN, which only
+// results if every value is NaN.
+static void Extremes (const double *lo, const double *hi, size_t begin,
+                      size_t end, double *low, double *high) {
+  double a = std::numeric_limits<double>::infinity();
+  double b = -a;
+  for (size_t i = begin; i != end; ++i) {
+    a = lo[i] < a ? lo[i] : a;
+    b = hi[i] > b ? hi[i] : b;
+  }
+  if (a > b) {
+    a = b = std::numeric_limits<double>::quiet_NaN();
+  }
+  *low = a;
+  *high = b;
+}
+
+//======================================================================
+SeriesPyramid::SeriesPyramid (const std::string &name, double x_start,
+                              double x_step, size_t threads) :
+    name_{name},
+    x_start_{x_start},
+    x_step_{x_step},
+    threads_{threads != 0 ? threads
+             : std::max(1u, std::thread::hardware_concurrency())}
+{}
+
+void SeriesPyramid::Extend (const double *source, size_t count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (count < samples_.size()) {
+    throw std::runtime_error("SeriesPyramid " + name_ + " can only grow");
+  }
+
+  // The last block of each level may have been partial, so is rebuilt
+  size_t from = samples_.size() / BASE_BLOCK;
+  samples_.insert(samples_.end(), source + samples_.size(), source + count);
+  const double *samples = samples_.data();
+
+  // Level 1 from the samples, split between threads when there are many
+  size_t blocks = (count + BASE_BLOCK - 1) / BASE_BLOCK;
+  if (mins_.empty()) {
+    mins_.emplace_back();
+    maxs_.emplace_back();
+  }
+  mins_[0].resize(blocks);
+  maxs_[0].resize(blocks);
+  const size_t threads = blocks - from >= PARALLEL_BLOCKS ? threads_ : 1;
+  const size_t per_thread = (blocks - from + threads - 1) / threads;
+  RunOnThreads(threads, [&] (size_t t) {
+    const size_t begin = std::min(blocks, from + t * per_thread);
+    const size_t end = std::min(blocks, begin + per_thread);
+    for (size_t b = begin; b != end; ++b) {
+      Extremes(samples, samples, b * BASE_BLOCK,
+               std::min(count, (b + 1) * BASE_BLOCK),
+               &mins_[0][b], &maxs_[0][b]);
+    }
+  });
+
+  // Each level above from the one below, until one block covers everything
+  for (size_t level = 1; blocks > 1; ++level) {
+    const size_t below = blocks;
+    from /= FANOUT;
+    blocks = (below + FANOUT - 1) / FANOUT;
+    if (mins_.size() == level) {
+      mins_.emplace_back();
+      maxs_.emplace_back();
+    }
+    mins_[level].resize(blocks);
+    maxs_[level].resize(blocks);
+    for (size_t b = from; b != blocks; ++b) {
+      Extremes(mins_[level - 1].data(), maxs_[level - 1].data(), b * FANOUT,
+               std::min(below, (b + 1) * FANOUT),
+               &mins_[level][b], &maxs_[level][b]);
+    }
+  }
+}
+
+SeriesPyramid::View SeriesPyramid::Query (uint64_t first, uint64_t last,
+                                          size_t pixels) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  last = std::min<uint64_t>(last, samples_.size());
+  first = std::min(first, last);
+  pixels = std::max<size_t>(pixels, 1);
+
+  // The coarsest level with at least pixels blocks across the window
+  const uint64_t span = last - first;
+  View view{0, 1, first, {}, {}};
+  uint64_t block = BASE_BLOCK;
+  for (size_t level = 1; level <= mins_.size() && span / block >= pixels;
+       ++level, block *= FANOUT) {
+    view.level = static_cast<uint8_t>(level);
+    view.block = block;
+  }
+
+  if (view.level == 0) {
+    view.mins.assign(samples_.begin() + first, samples_.begin() + last);
+    return view;
+  }
+  const std::vector<double> &mins = mins_[view.level - 1];
+  const std::vector<double> &maxs = maxs_[view.level - 1];
+  const uint64_t begin = first / view.block;
+  const uint64_t end = std::min<uint64_t>(
+      mins.size(), (last + view.block - 1) / view.block);
+  view.first = begin * view.block;
+  view.mins.assign(mins.begin() + begin, mins.begin() + end);
+  view.maxs.assign(maxs.begin() + begin, maxs.begin() + end);
+  return view;
+}
+
+size_t SeriesPyramid::Count (void) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return samples_.size();
+}
+
+void SeriesPyramid::SerializeHeaderTo (std::vector<uint8_t> *buffer) const {
+  buffer->clear();
+  Append(static_cast<uint64_t>(Count()), buffer);
+  Append(x_start_, buffer);
+  Append(x_step_, buffer);
+  buffer->insert(buffer->end(), name_.begin(), name_.end());
+}
+
+} // namespace
@@ -0,0 +1,122 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief A min/max pyramid over a long series, from which any window can be
+ * fetched at about the resolution it will be drawn at.
+ *
+ * Level 1 holds the minimum and maximum of each block of 64 samples, and
+ * every level above combines 4 blocks of the one below, so those levels
+ * are about a sixteenth the size of the series.  The pyramid keeps its own
+ * copy of the series as level 0, so the caller's buffer may grow, move or
+ * be freed after each Extend.  Levels are built in parallel and extended
+ * incrementally as samples are appended.
+ *
+ * The kernel fetches from the pyramid through a ZoomServer, see
+ * CppMatplotlib::SendPyramid.  Query may be called from the server's thread
+ * while Extend is called from another.
+ *
+ * Usage:
+\code
+    std::vector<double> samples;   // growing to a billion or so
+    SeriesPyramid pyramid("Recording", 0.0, 1.0 / sample_rate);
+    ZoomServer zoom;
+    ...
+    pyramid.Extend(samples.data(), samples.size());
+    mpl.SendPyramid(&pyramid, &zoom);
+    mpl.RunCode("cpp_ipython_show_pyramid('Recording')");
+\endcode
+ */
+class SeriesPyramid {
+public:
+  /// A window of the series at one level of the pyramid.
+  struct View {
+    /// 0 for samples, otherwise the level of the min/max pairs.
+    uint8_t level;
+    /// The number of samples each point covers.
+    uint64_t block;
+    /// The index of the first sample covered.
+    uint64_t first;
+    /// The samples at level 0, otherwise the minimum of each block.
+    std::vector<double> mins;
+    /// The maximum of each block, empty at level 0.
+    std::vector<double> maxs;
+  };
+
+  //--------------------------------------------------
+  /** \brief Constructs an empty pyramid associated with a named variable in
+   * the iPython session.
+   *
+   * \param name  the name the series will have in the ipython session.
+   * \param x_start  the x coordinate of the first sample.
+   * \param x_step  the x distance between samples.
+   * \param threads  the number of threads to build with, 0 for one per
+   *                 core.
+   */
+  explicit SeriesPyramid (const std::string &name, double x_start = 0.0,
+                          double x_step = 1.0, size_t threads = 0);
+
+  //--------------------------------------------------
+  /** \brief Brings the pyramid up to date with the series after samples
+   * were appended, only rebuilding the blocks they fall in.
+   *
+   * \param source  the whole series.  Only the samples appended since the
+   *                last Extend are read, and copied, so source need only
+   *                be valid during the call.
+   * \param count  the number of samples in source.
+   *
+   * \throws std::runtime_error  if count is less than before.
+   */
+  void Extend (const double *source, size_t count);
+
+  //--------------------------------------------------
+  /** \brief Returns samples first to last at the coarsest level that still
+   * has at least pixels points across them.
+   */
+  View Query (uint64_t first, uint64_t last, size_t pixels) const;
+
+  //--------------------------------------------------
+  /** \brief Serializes the sample count, x axis and name.
+   *
+   * \param buffer  the byte buffer to be serialized into.  Overwrites
+   *                previous contents.
+   */
+  void SerializeHeaderTo (std::vector<uint8_t> *buffer) const;
+
+  size_t Count (void) const;
+  double XStart (void) const { return x_start_; }
+  double XStep (void) const { return x_step_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the name of the iPython variable this series is
+   * associated with.
+   */
+  std::string Name (void) const { return name_; }
+
+private:
+  const std::string name_;
+  const double x_start_;
+  const double x_step_;
+  const size_t threads_;
+
+  mutable std::mutex mutex_;
+  // Level 0
+  std::vector<double> samples_;
+  // Levels 1 and up
+  std::vector<std::vector<double>> mins_;
+  std::vector<std::vector<double>> maxs_;
+};
+
+} // namespace
@@ -0,0 +1,259 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "cpp_mpl.hpp"
+#include "SessionLog.hpp"
+
+namespace cppmpl {
+
+// Log layout: a FileHeader, then records, each a RecordHeader followed by
+// the payload padded to 8 bytes.  The index is an array of IndexEntry.
+static const char MAGIC[8] = {'C', 'P', 'P', 'M', 'P', 'L', 'L', '1'};
+
+struct FileHeader {
+  char magic[8];
+  uint64_t start_unix_ns;
+  uint64_t records;
+  uint64_t log_used;
+};
+
+struct RecordHeader {
+  uint64_t time_ns;
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t size;
+};
+
+struct IndexEntry {
+  uint64_t time_ns;
+  uint64_t offset;
+};
+
+static const size_t INITIAL_CAPACITY = 1 << 24;
+
+static uint64_t SteadyNs (void) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int OpenOrThrow (const std::string &path, int flags) {
+  int fd = open(path.c_str(), flags, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("Unable to open " + path);
+  }
+  return fd;
+}
+
+//======================================================================
+SessionRecorder::SessionRecorder (const std::string &path) :
+    log_{OpenOrThrow(path, O_RDWR | O_CREAT | O_TRUNC), nullptr, 0},
+    index_{OpenOrThrow(path + ".idx", O_RDWR | O_CREAT | O_TRUNC),
+           nullptr, 0},
+    start_ns_{SteadyNs()},
+    log_used_{sizeof(FileHeader)},
+    records_{0}
+{
+  Reserve_(&log_, INITIAL_CAPACITY);
+  Reserve_(&index_, INITIAL_CAPACITY / 64);
+
+  FileHeader header;
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.start_unix_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  header.records = 0;
+  header.log_used = log_used_;
+  std::memcpy(log_.base, &header, sizeof(header));
+}
+
+SessionRecorder::~SessionRecorder (void) {
+  for (Mapping *mapping : {&log_, &index_}) {
+    munmap(mapping->base, mapping->capacity);
+  }
+  if (ftruncate(log_.fd, log_used_) != 0 ||
+      ftruncate(index_.fd, records_ * sizeof(IndexEntry)) != 0) {
+    // Nothing to be done in a destructor; the header still says how much
+    // of the file is valid.
+  }
+  close(log_.fd);
+  close(index_.fd);
+}
+
+void SessionRecorder::Append (RecordType type, const void *data,
+                              size_t size) {
+  const size_t padded = (size + 7) & ~size_t{7};
+  Reserve_(&log_, log_used_ + sizeof(RecordHeader) + padded);
+  Reserve_(&index_, (records_ + 1) * sizeof(IndexEntry));
+
+  RecordHeader record{SteadyNs() - start_ns_, static_cast<uint32_t>(type),
+                      0, size};
+  std::memcpy(log_.base + log_used_, &record, sizeof(record));
+  // data may be null for an empty request, which memcpy does not allow
+  if (size != 0) {
+    std::memcpy(log_.base + log_used_ + sizeof(record), data, size);
+  }
+
+  IndexEntry entry{record.time_ns, log_used_};
+  std::memcpy(index_.base + records_ * sizeof(entry), &entry, sizeof(entry));
+
+  // Publish in the header last, so a crash leaves a consistent prefix
+  log_used_ += sizeof(record) + padded;
+  ++records_;
+  FileHeader *header = reinterpret_cast<FileHeader*>(log_.base);
+  header->log_used = log_used_;
+  header->records = records_;
+}
+
+void SessionRecorder::Reserve_ (Mapping *mapping, size_t size) {
+  if (size <= mapping->capacity) {
+    return;
+  }
+  size_t capacity = std::max<size_t>(mapping->capacity, INITIAL_CAPACITY/64);
+  while (capacity < size) {
+    capacity *= 2;
+  }
+  if (mapping->base) {
+    munmap(mapping->base, mapping->capacity);
+  }
+  void *base = MAP_FAILED;
+  if (ftruncate(mapping->fd, capacity) == 0) {
+    base = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+                mapping->fd, 0);
+  }
+  if (base == MAP_FAILED) {
+    mapping->base = nullptr;
+    mapping->capacity = 0;
+    throw std::runtime_error("Unable to grow session log");
+  }
+  mapping->base = static_cast<uint8_t*>(base);
+  mapping->capacity = capacity;
+}
+
+
+//======================================================================
+// Maps a whole file read-only.
+static const uint8_t* MapFile (const std::string &path, size_t *size) {
+  int fd = OpenOrThrow(path, O_RDONLY);
+  struct stat info;
+  void *base = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    *size = info.st_size;
+    base = mmap(nullptr, *size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (base == MAP_FAILED) {
+    throw std::runtime_error("Unable to map " + path);
+  }
+  return static_cast<const uint8_t*>(base);
+}
+
+SessionReplayer::SessionReplayer (const std::string &path) :
+    log_{MapFile(path, &log_size_)},
+    index_{nullptr},
+    index_size_{0},
+    records_{0},
+    position_{0}
+{
+  FileHeader header;
+  if (log_size_ < sizeof(header) ||
+      std::memcmp(log_, MAGIC, sizeof(MAGIC)) != 0) {
+    munmap(const_cast<uint8_t*>(log_), log_size_);
+    throw std::runtime_error(path + " is not a session log");
+  }
+  std::memcpy(&header, log_, sizeof(header));
+  records_ = header.records;
+  if (records_ != 0) {
+    index_ = MapFile(path + ".idx", &index_size_);
+    records_ = std::min<size_t>(records_, index_size_ / sizeof(IndexEntry));
+  }
+}
+
+SessionReplayer::~SessionReplayer (void) {
+  munmap(const_cast<uint8_t*>(log_), log_size_);
+  if (index_) {
+    munmap(const_cast<uint8_t*>(index_), index_size_);
+  }
+}
+
+SessionReplayer::Record SessionReplayer::Get (size_t i) const {
+  IndexEntry entry;
+  std::memcpy(&entry, index_ + i * sizeof(entry), sizeof(entry));
+  RecordHeader header;
+  // Both come from the file, so are checked against the mapping before use
+  if (entry.offset > log_size_ - sizeof(header)) {
+    throw std::runtime_error("Session log record " + std::to_string(i)
+                             + " is outside the log");
+  }
+  std::memcpy(&header, log_ + entry.offset, sizeof(header));
+  if (header.size > log_size_ - entry.offset - sizeof(header)) {
+    throw std::runtime_error("Session log record " + std::to_string(i)
+                             + " is truncated");
+  }
+  return Record{header.time_ns, static_cast<RecordType>(header.type),
+                log_ + entry.offset + sizeof(header), header.size};
+}
+
+void SessionReplayer::Seek (uint64_t time_ns) {
+  // Binary search on the index, which is sorted by time
+  size_t low = 0;
+  size_t high = records_;
+  while (low < high) {
+    const size_t middle = low + (high - low) / 2;
+    uint64_t middle_ns;
+    std::memcpy(&middle_ns, index_ + middle * sizeof(IndexEntry),
+                sizeof(middle_ns));
+    if (middle_ns < time_ns) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  position_ = low;
+}
+
+size_t SessionReplayer::Replay (CppMatplotlib *mpl, double speed,
+                                uint64_t end_ns) {
+  if (position_ >= records_) {
+    return 0;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  const uint64_t first_ns = Get(position_).time_ns;
+  size_t sent = 0;
+  for (; position_ < records_; ++position_, ++sent) {
+    const Record record = Get(position_);
+    if (record.time_ns >= end_ns) {
+      break;
+    }
+    if (speed > 0) {
+      std::this_thread::sleep_until(
+          start + std::chrono::nanoseconds(static_cast<int64_t>(
+              (record.time_ns - first_ns) / speed)));
+    }
+    switch (record.type) {
+    case RecordType::DATA:
+      mpl->SendSerialized(record.data, record.size);
+      break;
+    case RecordType::CODE:
+      mpl->RunCode(std::string{reinterpret_cast<const char*>(record.data),
+                               record.size});
+      break;
+    }
+  }
+  return sent;
+}
+
+} // namespace
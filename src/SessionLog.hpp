@@ -0,0 +1,156 @@
+// 
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+// 
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace cppmpl {
+
+// Forward declarations
+class CppMatplotlib;
+
+/// The kinds of request stored in a session log.
+enum class RecordType : uint32_t {
+  DATA = 1,  ///< a serialized NumpyArray, as sent by SendData
+  CODE = 2   ///< code, as sent by RunCode
+};
+
+//======================================================================
+/** \brief Appends everything sent through a CppMatplotlib to an indexed,
+ * memory-mapped log on disk.
+ *
+ * Appending is a memcpy into the mapping plus a few stores, with a remap
+ * only when the file has to grow, so recording adds next to nothing to the
+ * send path.  A second file, path + ".idx", holds the time and offset of
+ * every record so a SessionReplayer can seek by time.
+ *
+ * Usage:
+\code
+    SessionRecorder recorder{"run42.cpplog"};
+    mpl.SetRecorder(&recorder);
+    // ... SendData and RunCode as usual ...
+\endcode
+ */
+class SessionRecorder {
+public:
+  //--------------------------------------------------
+  /** \brief Creates (or truncates) the log and its index.
+   *
+   * \throws std::runtime_error  if the files cannot be created.
+   */
+  explicit SessionRecorder (const std::string &path);
+
+  //--------------------------------------------------
+  /** \brief Trims the files to the recorded size and closes them.
+   */
+  ~SessionRecorder (void);
+
+  SessionRecorder (const SessionRecorder&) = delete;
+  SessionRecorder& operator= (const SessionRecorder&) = delete;
+
+  //--------------------------------------------------
+  /** \brief Appends one request, timestamped with the time since the
+   * recorder was created.
+   *
+   * \param type  what kind of request this is.
+   * \param data  the request payload.
+   * \param size  the number of bytes in data.
+   */
+  void Append (RecordType type, const void *data, size_t size);
+
+private:
+  struct Mapping {
+    int fd;
+    uint8_t *base;
+    size_t capacity;
+  };
+
+  void Reserve_ (Mapping *mapping, size_t size);
+
+  Mapping log_;
+  Mapping index_;
+  uint64_t start_ns_;
+  uint64_t log_used_;
+  uint64_t records_;
+};
+
+//======================================================================
+/** \brief Streams a log written by SessionRecorder back to a kernel.
+ *
+ * The log is memory-mapped, so it is paged in as it is replayed rather than
+ * loaded up front, and seeking is a binary search of the index.
+ *
+ * Usage:
+\code
+    SessionReplayer replayer{"run42.cpplog"};
+    replayer.Seek(30 * 1000000000ull);  // skip the first 30 seconds
+    replayer.Replay(&mpl, 4.0);          // at 4x speed
+\endcode
+ */
+class SessionReplayer {
+public:
+  /// One recorded request, pointing into the mapped log.
+  struct Record {
+    uint64_t time_ns;
+    RecordType type;
+    const uint8_t *data;
+    size_t size;
+  };
+
+  //--------------------------------------------------
+  /** \throws std::runtime_error  if the log or index cannot be read.
+   */
+  explicit SessionReplayer (const std::string &path);
+  ~SessionReplayer (void);
+
+  SessionReplayer (const SessionReplayer&) = delete;
+  SessionReplayer& operator= (const SessionReplayer&) = delete;
+
+  //--------------------------------------------------
+  /** \brief Returns the number of records in the log.
+   */
+  size_t Records (void) const { return records_; }
+
+  //--------------------------------------------------
+  /** \brief Returns record i, 0 <= i < Records().
+   *
+   * \throws std::runtime_error  if the index points outside the log or the
+   *                             record runs past its end, e.g. for a log
+   *                             cut short by a crash.
+   */
+  Record Get (size_t i) const;
+
+  //--------------------------------------------------
+  /** \brief Moves to the first record at or after time_ns since the start
+   * of the recording.
+   */
+  void Seek (uint64_t time_ns);
+
+  //--------------------------------------------------
+  /** \brief Sends the records from the current position onwards.
+   *
+   * \param mpl  the connection to replay to.
+   * \param speed  1 for the original pace, N for N times faster, or 0 for
+   *               as fast as possible.
+   * \param end_ns  stop before the first record at or after this time.
+   *
+   * \returns the number of records sent.
+   */
+  size_t Replay (CppMatplotlib *mpl, double speed = 1.0,
+                 uint64_t end_ns = UINT64_MAX);
+
+private:
+  const uint8_t *log_;
+  size_t log_size_;
+  const uint8_t *index_;
+  size_t index_size_;
+  size_t records_;
+  size_t position_;
+};
+
+} // namespace
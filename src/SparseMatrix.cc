@@ -0,0 +1,85 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <limits>
+#include <stdexcept>
+
+#include "SparseMatrix.hpp"
+#include "wire_util.hpp"
+
+namespace cppmpl {
+
+//======================================================================
+SparseMatrix::SparseMatrix (const std::string &name, Format format,
+                            size_t rows, size_t cols,
+                            std::vector<index_type> indptr,
+                            std::vector<index_type> indices,
+                            std::vector<dtype> values) :
+    name_{name},
+    format_{format},
+    rows_{rows},
+    cols_{cols},
+    indices0_{std::move(indptr)},
+    indices1_{std::move(indices)},
+    values_{std::move(values)}
+{
+  if (format == Format::COO) {
+    throw std::runtime_error("Use the COO constructor for " + name);
+  }
+  Validate_();
+}
+
+SparseMatrix::SparseMatrix (const std::string &name, size_t rows, size_t cols,
+                            std::vector<index_type> row_indices,
+                            std::vector<index_type> col_indices,
+                            std::vector<dtype> values) :
+    name_{name},
+    format_{Format::COO},
+    rows_{rows},
+    cols_{cols},
+    indices0_{std::move(row_indices)},
+    indices1_{std::move(col_indices)},
+    values_{std::move(values)}
+{
+  Validate_();
+}
+
+void SparseMatrix::Validate_ (void) const {
+  const size_t max_index = std::numeric_limits<index_type>::max();
+  if (rows_ > max_index || cols_ > max_index || values_.size() > max_index) {
+    throw std::runtime_error(name_ + " is too large for int32 indices");
+  }
+  if (indices1_.size() != values_.size()) {
+    throw std::runtime_error(name_ + " needs one index per value");
+  }
+
+  switch (format_) {
+  case Format::CSR:
+  case Format::CSC: {
+    const size_t major = format_ == Format::CSR ? rows_ : cols_;
+    if (indices0_.size() != major + 1 ||
+        static_cast<size_t>(indices0_.back()) != values_.size()) {
+      throw std::runtime_error(name_ + " has an inconsistent indptr");
+    }
+    break;
+  }
+  case Format::COO:
+    if (indices0_.size() != values_.size()) {
+      throw std::runtime_error(name_ + " needs one index per value");
+    }
+    break;
+  }
+}
+
+void SparseMatrix::SerializeHeaderTo (std::vector<uint8_t> *buffer) const {
+  buffer->clear();
+  Append(static_cast<uint8_t>(format_), buffer);
+  Append(static_cast<uint64_t>(rows_), buffer);
+  Append(static_cast<uint64_t>(cols_), buffer);
+  buffer->insert(buffer->end(), name_.begin(), name_.end());
+}
+
+} // namespace
@@ -0,0 +1,136 @@
+// 
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+// 
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief Container class to represent a sparse matrix that becomes a
+ * scipy.sparse matrix in the iPython session.
+ *
+ * CSR, CSC and COO layouts are supported, with the same array conventions
+ * as scipy.sparse, and only the index and value arrays are sent.  Indices
+ * are int32, like scipy uses for anything with fewer than 2^31 entries.
+ *
+ * Usage:
+\code
+    // 3x3 identity in CSR form
+    SparseMatrix eye("Eye", SparseMatrix::Format::CSR, 3, 3,
+                     {0, 1, 2, 3},        // indptr
+                     {0, 1, 2},           // column indices
+                     {1.0, 1.0, 1.0});    // values
+    mpl.SendSparse(eye);
+    mpl.RunCode("spy(Eye)");
+\endcode
+ */
+class SparseMatrix {
+public:
+  /// The type of the values.
+  typedef double dtype;
+
+  /// The type of the index arrays.
+  typedef int32_t index_type;
+
+  /// The layout of the index arrays, as in scipy.sparse.
+  enum class Format : uint8_t {CSR, CSC, COO};
+
+  //--------------------------------------------------
+  /** \brief Constructs a compressed (CSR or CSC) sparse matrix.  Pass the
+   * vectors with std::move to avoid copying them.
+   *
+   * \param name  the name the matrix will have in the ipython session.
+   * \param format  Format::CSR or Format::CSC.
+   * \param rows  the number of rows.
+   * \param cols  the number of columns.
+   * \param indptr  rows+1 (CSR) or cols+1 (CSC) offsets into indices.
+   * \param indices  the column (CSR) or row (CSC) of each value.
+   * \param values  the non-zero values.
+   *
+   * \throws std::runtime_error  if the arrays are inconsistent.
+   */
+  SparseMatrix (const std::string &name, Format format,
+                size_t rows, size_t cols,
+                std::vector<index_type> indptr,
+                std::vector<index_type> indices,
+                std::vector<dtype> values);
+
+  //--------------------------------------------------
+  /** \brief Constructs a coordinate (COO) sparse matrix.  Pass the vectors
+   * with std::move to avoid copying them.
+   *
+   * \param name  the name the matrix will have in the ipython session.
+   * \param rows  the number of rows.
+   * \param cols  the number of columns.
+   * \param row_indices  the row of each value.
+   * \param col_indices  the column of each value.
+   * \param values  the non-zero values.
+   *
+   * \throws std::runtime_error  if the arrays are inconsistent.
+   */
+  SparseMatrix (const std::string &name, size_t rows, size_t cols,
+                std::vector<index_type> row_indices,
+                std::vector<index_type> col_indices,
+                std::vector<dtype> values);
+
+  //--------------------------------------------------
+  /** \brief Serializes the format, shape and name.  The index and value
+   * arrays are sent as they are, see Indices0, Indices1 and Values.
+   *
+   * \param buffer  the byte buffer to be serialized into.  Overwrites
+   *                previous contents.
+   */
+  void SerializeHeaderTo (std::vector<uint8_t> *buffer) const;
+
+  //--------------------------------------------------
+  /** \brief Returns indptr for CSR/CSC, or the row indices for COO.
+   */
+  const std::vector<index_type>& Indices0 (void) const { return indices0_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the column/row indices for CSR/CSC, or the column
+   * indices for COO.
+   */
+  const std::vector<index_type>& Indices1 (void) const { return indices1_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the non-zero values.
+   */
+  const std::vector<dtype>& Values (void) const { return values_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the number of stored values.
+   */
+  size_t NonZeros (void) const { return values_.size(); }
+
+  //--------------------------------------------------
+  /** \brief Returns the layout of this matrix.
+   */
+  Format Layout (void) const { return format_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the name of the iPython variable this matrix is
+   * associated with.
+   */
+  std::string Name (void) const { return name_; }
+
+private:
+  void Validate_ (void) const;
+
+  const std::string name_;
+  const Format format_;
+  const size_t rows_;
+  const size_t cols_;
+  std::vector<index_type> indices0_;
+  std::vector<index_type> indices1_;
+  std::vector<dtype> values_;
+};
+
+} // namespace
@@ -0,0 +1,208 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "SpillStore.hpp"
+#include "wire_util.hpp"
+
+namespace cppmpl {
+
+struct SpillStore::Payload {
+  enum class State {QUEUED, SPILLED, SENDING, RELEASED};
+
+  std::vector<uint8_t> bytes;
+  size_t size;
+  State state;
+  // Where it is in the spill file, if it went there, and its mapping once
+  // acquired from there
+  bool in_file;
+  uint64_t offset;
+  void *map;
+  std::list<Payload*>::iterator position;
+};
+
+static std::runtime_error SpillError (const std::string &what) {
+  return std::runtime_error("Spill file " + what + ": " + strerror(errno));
+}
+
+//======================================================================
+SpillStore::SpillStore (size_t budget, const std::string &directory) :
+    directory_{directory.empty() ? TempDirectory() : directory},
+    stats_{budget, 0, 0, 0, 0, 0},
+    fd_{-1},
+    file_end_{0},
+    file_payloads_{0}
+{}
+
+SpillStore::~SpillStore (void) {
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+void SpillStore::SetBudget (size_t budget) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.budget = budget;
+  SpillOverBudget_();
+}
+
+SpillStore::Handle SpillStore::Admit (std::vector<uint8_t> &&bytes) {
+  Handle payload{new Payload};
+  payload->bytes = std::move(bytes);
+  payload->size = payload->bytes.size();
+  payload->state = Payload::State::QUEUED;
+  payload->in_file = false;
+  payload->offset = 0;
+  payload->map = nullptr;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  payload->position = queued_.insert(queued_.end(), payload.get());
+  stats_.resident_bytes += payload->size;
+  try {
+    SpillOverBudget_();
+  } catch (...) {
+    if (payload->state == Payload::State::QUEUED) {
+      queued_.erase(payload->position);
+      stats_.resident_bytes -= payload->size;
+    }
+    throw;
+  }
+  return payload;
+}
+
+SpillStore::View SpillStore::Acquire (const Handle &payload) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (payload->state == Payload::State::QUEUED) {
+    queued_.erase(payload->position);
+  } else if (payload->state == Payload::State::SPILLED) {
+    // Read back through the page cache as the send goes, sequentially
+    if (payload->size != 0) {
+      void *map = mmap(nullptr, payload->size, PROT_READ, MAP_SHARED, fd_,
+                       payload->offset);
+      if (map == MAP_FAILED) {
+        throw SpillError("mapping");
+      }
+      madvise(map, payload->size, MADV_SEQUENTIAL);
+      payload->map = map;
+    }
+    stats_.spilled_bytes -= payload->size;
+    --stats_.spilled_payloads;
+    stats_.resident_bytes += payload->size;
+  } else {
+    throw std::logic_error("SpillStore payload acquired twice");
+  }
+  payload->state = Payload::State::SENDING;
+  stats_.in_flight_bytes += payload->size;
+
+  if (payload->map) {
+    return View{static_cast<const uint8_t*>(payload->map), payload->size};
+  }
+  return View{payload->bytes.data(), payload->size};
+}
+
+void SpillStore::Release (const Handle &payload) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  switch (payload->state) {
+  case Payload::State::QUEUED:
+    queued_.erase(payload->position);
+    stats_.resident_bytes -= payload->size;
+    break;
+  case Payload::State::SPILLED:
+    stats_.spilled_bytes -= payload->size;
+    --stats_.spilled_payloads;
+    break;
+  case Payload::State::SENDING:
+    stats_.resident_bytes -= payload->size;
+    stats_.in_flight_bytes -= payload->size;
+    break;
+  case Payload::State::RELEASED:
+    return;
+  }
+  payload->state = Payload::State::RELEASED;
+  std::vector<uint8_t>().swap(payload->bytes);
+  if (payload->map) {
+    munmap(payload->map, payload->size);
+    payload->map = nullptr;
+  }
+
+  // Hand the space back to the filesystem, all at once when possible
+  if (payload->in_file && --file_payloads_ == 0) {
+    file_end_ = 0;
+    if (ftruncate(fd_, 0) != 0) {
+      // Harmless: the file is overwritten from the start next time
+    }
+  } else if (payload->in_file) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+    fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+              payload->offset, payload->size);
+#endif
+  }
+}
+
+SpillStore::Stats SpillStore::GetStats (void) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void SpillStore::SpillOverBudget_ (void) {
+  while (stats_.budget != 0 && stats_.resident_bytes > stats_.budget &&
+         !queued_.empty()) {
+    Spill_(queued_.front());
+  }
+}
+
+void SpillStore::Spill_ (Payload *payload) {
+  if (fd_ == -1) {
+    std::string path = directory_ + "/cpp-matplotlib-spill-XXXXXX";
+    fd_ = mkstemp(&path[0]);
+    if (fd_ == -1) {
+      throw SpillError("creation in " + directory_);
+    }
+    unlink(path.c_str());
+  }
+
+  // Page aligned, so each payload can be mapped on its own
+  static const uint64_t page = sysconf(_SC_PAGESIZE);
+  const uint64_t offset = (file_end_ + page - 1) / page * page;
+  const uint8_t *data = payload->bytes.data();
+  for (size_t written = 0; written < payload->size; ) {
+    ssize_t count = pwrite(fd_, data + written, payload->size - written,
+                           offset + written);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      // Nothing written without an error, e.g. a full device, would
+      // otherwise retry forever
+      if (count == 0) {
+        errno = ENOSPC;
+      }
+      throw SpillError("write");
+    }
+    written += count;
+  }
+
+  queued_.erase(payload->position);
+  std::vector<uint8_t>().swap(payload->bytes);
+  payload->state = Payload::State::SPILLED;
+  payload->in_file = true;
+  payload->offset = offset;
+  file_end_ = offset + payload->size;
+  ++file_payloads_;
+  stats_.resident_bytes -= payload->size;
+  stats_.spilled_bytes += payload->size;
+  ++stats_.spilled_payloads;
+  stats_.total_spilled_bytes += payload->size;
+}
+
+} // namespace
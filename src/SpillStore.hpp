@@ -0,0 +1,125 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief Holds serialized payloads between being queued and being sent,
+ * keeping the memory they take within a budget.
+ *
+ * Payloads count against the budget from Admit until Release, whether
+ * queued or being sent.  Once the budget is exceeded, the oldest queued
+ * payloads are written to a temporary file and their memory freed; Acquire
+ * maps them back in from the file when their turn comes.  The file is
+ * unlinked as soon as it is created, so nothing is left behind, and is
+ * emptied whenever no payloads remain spilled.
+ *
+ * All methods are safe to call from any thread.
+ *
+ * Usage:
+\code
+    SpillStore store{256 << 20};
+    SpillStore::Handle payload = store.Admit(std::move(bytes));
+    ...
+    SpillStore::View view = store.Acquire(payload);
+    send(view.data, view.size);
+    store.Release(payload);
+\endcode
+ */
+class SpillStore {
+public:
+  struct Payload;
+  typedef std::shared_ptr<Payload> Handle;
+
+  /// The bytes of an acquired payload, valid until it is released.
+  struct View {
+    const uint8_t *data;
+    size_t size;
+  };
+
+  /// A snapshot of the store's accounting.
+  struct Stats {
+    /// The memory budget in bytes, 0 for none.
+    size_t budget;
+    /// Bytes held in memory, queued or being sent.
+    size_t resident_bytes;
+    /// Of which being sent.
+    size_t in_flight_bytes;
+    /// Bytes waiting in the spill file, and how many payloads they make.
+    size_t spilled_bytes;
+    size_t spilled_payloads;
+    /// Bytes ever written to the spill file.
+    uint64_t total_spilled_bytes;
+  };
+
+  //--------------------------------------------------
+  /** \param budget  the most memory payloads may hold in bytes, 0 for no
+   *                limit.
+   * \param directory  where to create the spill file, by default $TMPDIR
+   *                   or /tmp.
+   */
+  explicit SpillStore (size_t budget = 0, const std::string &directory = "");
+  ~SpillStore (void);
+
+  SpillStore (const SpillStore&) = delete;
+  SpillStore& operator= (const SpillStore&) = delete;
+
+  //--------------------------------------------------
+  /** \brief Changes the budget, spilling at once if it is now exceeded.
+   *
+   * \throws std::runtime_error  if the spill file cannot be written.
+   */
+  void SetBudget (size_t budget);
+
+  //--------------------------------------------------
+  /** \brief Takes over a payload and queues it, spilling the oldest queued
+   * payloads, possibly this one, while over budget.
+   *
+   * \throws std::runtime_error  if the spill file cannot be written.
+   */
+  Handle Admit (std::vector<uint8_t> &&bytes);
+
+  //--------------------------------------------------
+  /** \brief Takes a payload off the queue to be sent, mapping it back in if
+   * it was spilled.  It is no longer spilled after this.
+   *
+   * \throws std::runtime_error  if the spill file cannot be mapped.
+   */
+  View Acquire (const Handle &payload);
+
+  //--------------------------------------------------
+  /** \brief Discards a payload, whether acquired or not.
+   */
+  void Release (const Handle &payload);
+
+  Stats GetStats (void) const;
+
+private:
+  void Spill_ (Payload *payload);
+  void SpillOverBudget_ (void);
+
+  const std::string directory_;
+  mutable std::mutex mutex_;
+  Stats stats_;
+  // Payloads in memory that can still be spilled, oldest first
+  std::list<Payload*> queued_;
+
+  // The spill file, once needed, its end, and how many payloads are in it
+  int fd_;
+  uint64_t file_end_;
+  size_t file_payloads_;
+};
+
+} // namespace
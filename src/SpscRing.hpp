@@ -0,0 +1,122 @@
+// 
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+// 
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief Fixed capacity wait-free single-producer single-consumer ring
+ * buffer.
+ *
+ * All memory is allocated at construction.  Push never allocates, makes no
+ * system calls and never waits: when the ring is full the value is dropped
+ * and counted as an overrun instead.  Exactly one thread may Push and one
+ * (other) thread may Pop.
+ */
+template <typename T>
+class SpscRing {
+public:
+  //--------------------------------------------------
+  /** \param capacity  the number of values held, rounded up to a power of
+   *                   two.
+   */
+  explicit SpscRing (size_t capacity)
+    : mask_{RoundUp_(capacity) - 1},
+      buffer_{new T[mask_ + 1]},
+      write_{0}, read_cache_{0}, read_{0}, overruns_{0}
+  {}
+
+  SpscRing (const SpscRing&) = delete;
+  SpscRing& operator= (const SpscRing&) = delete;
+
+  //--------------------------------------------------
+  /** \brief Appends a value.  Producer thread only, real-time safe.
+   *
+   * \returns false, counting an overrun, if the ring was full.
+   */
+  bool Push (const T &value) {
+    const uint64_t write = write_.load(std::memory_order_relaxed);
+    if (write - read_cache_ > mask_) {
+      // Only look at the consumer's index when our cached copy says full
+      read_cache_ = read_.load(std::memory_order_acquire);
+      if (write - read_cache_ > mask_) {
+        overruns_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+    buffer_[write & mask_] = value;
+    write_.store(write + 1, std::memory_order_release);
+    return true;
+  }
+
+  //--------------------------------------------------
+  /** \brief Removes up to max_count of the oldest values.  Consumer thread
+   * only.
+   *
+   * \returns the number of values written to out.
+   */
+  size_t Pop (T *out, size_t max_count) {
+    const uint64_t read = read_.load(std::memory_order_relaxed);
+    const uint64_t write = write_.load(std::memory_order_acquire);
+    size_t count = write - read < max_count ? write - read : max_count;
+    for (size_t i = 0; i != count; ++i) {
+      out[i] = buffer_[(read + i) & mask_];
+    }
+    read_.store(read + count, std::memory_order_release);
+    return count;
+  }
+
+  //--------------------------------------------------
+  /** \brief Returns the number of values dropped because the ring was full.
+   */
+  uint64_t Overruns (void) const {
+    return overruns_.load(std::memory_order_relaxed);
+  }
+
+  //--------------------------------------------------
+  /** \brief Returns the number of values ever pushed successfully.
+   */
+  uint64_t Pushed (void) const {
+    return write_.load(std::memory_order_relaxed);
+  }
+
+  size_t Capacity (void) const { return mask_ + 1; }
+
+private:
+  static size_t RoundUp_ (size_t capacity) {
+    if (capacity == 0) {
+      throw std::runtime_error("SpscRing capacity must be positive");
+    }
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    return size;
+  }
+
+  const size_t mask_;
+  std::unique_ptr<T[]> buffer_;
+
+  // Producer side, padded away from the consumer side to avoid false
+  // sharing.  (Padding rather than alignas, which C++11 new ignores.)
+  char pad0_[64];
+  std::atomic<uint64_t> write_;
+  uint64_t read_cache_;
+  char pad1_[64];
+
+  std::atomic<uint64_t> read_;
+  std::atomic<uint64_t> overruns_;
+  char pad2_[64];
+};
+
+} // namespace
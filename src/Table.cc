@@ -0,0 +1,89 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <unordered_map>
+
+#include "Table.hpp"
+#include "wire_util.hpp"
+
+namespace cppmpl {
+
+// Appends a string as its uint32 length followed by its bytes.
+static void AppendString (const std::string &str,
+                          std::vector<uint8_t> *buffer) {
+  Append(static_cast<uint32_t>(str.size()), buffer);
+  buffer->insert(buffer->end(), str.begin(), str.end());
+}
+
+//======================================================================
+void Table::AddTimestampColumn (const std::string &name,
+                                const std::vector<int64_t> &nanoseconds) {
+  Column &column = NewColumn_(name, ColumnType::TIMESTAMP,
+                              nanoseconds.size());
+  column.buffers.emplace_back(sizeof(int64_t)*nanoseconds.size());
+  std::memcpy(column.buffers.back().data(), nanoseconds.data(),
+              sizeof(int64_t)*nanoseconds.size());
+}
+
+void Table::AddStringColumn (const std::string &name,
+                             const std::vector<std::string> &values) {
+  Column &column = NewColumn_(name, ColumnType::CATEGORY, values.size());
+  column.buffers.resize(3);
+  std::vector<uint8_t> &codes = column.buffers[0];
+  std::vector<uint8_t> &offsets = column.buffers[1];
+  std::vector<uint8_t> &chars = column.buffers[2];
+
+  // Codes index into the dictionary, which is stored Arrow style as one
+  // byte buffer plus n+1 offsets into it.
+  std::unordered_map<std::string, int32_t> dictionary;
+  codes.resize(sizeof(int32_t)*values.size());
+  int32_t *code = reinterpret_cast<int32_t*>(codes.data());
+  Append(static_cast<int32_t>(0), &offsets);
+  for (const std::string &value : values) {
+    auto entry = dictionary.find(value);
+    if (entry == dictionary.end()) {
+      entry = dictionary.emplace(value, dictionary.size()).first;
+      chars.insert(chars.end(), value.begin(), value.end());
+      Append(static_cast<int32_t>(chars.size()), &offsets);
+    }
+    *code++ = entry->second;
+  }
+}
+
+void Table::SerializeHeaderTo (std::vector<uint8_t> *buffer) const {
+  buffer->clear();
+  AppendString(name_, buffer);
+  Append(static_cast<uint64_t>(rows_), buffer);
+  Append(static_cast<uint32_t>(columns_.size()), buffer);
+  for (const Column &column : columns_) {
+    Append(static_cast<uint8_t>(column.type), buffer);
+    AppendString(column.name, buffer);
+  }
+}
+
+std::vector<const std::vector<uint8_t>*> Table::Buffers (void) const {
+  std::vector<const std::vector<uint8_t>*> buffers;
+  for (const Column &column : columns_) {
+    for (const std::vector<uint8_t> &buffer : column.buffers) {
+      buffers.push_back(&buffer);
+    }
+  }
+  return buffers;
+}
+
+Table::Column& Table::NewColumn_ (const std::string &name, ColumnType type,
+                                  size_t rows) {
+  if (!columns_.empty() && rows != rows_) {
+    throw std::runtime_error("Column " + name + " has " +
+                             std::to_string(rows) + " rows, expected " +
+                             std::to_string(rows_));
+  }
+  rows_ = rows;
+  columns_.push_back(Column{name, type, {}});
+  return columns_.back();
+}
+
+} // namespace
@@ -0,0 +1,170 @@
+// 
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+// 
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief Container class to represent a table of named, typed columns that
+ * becomes a pandas.DataFrame in the iPython session.
+ *
+ * The whole table is sent in a single message with one contiguous buffer
+ * per column, so the listener can build the DataFrame columns directly on
+ * top of the received buffers.  Strings are dictionary encoded and
+ * timestamps are nanoseconds since the epoch (numpy's datetime64[ns]).
+ *
+ * Usage:
+\code
+    Table log("Log");
+    log.AddColumn("x", xs);                 // std::vector<double>
+    log.AddColumn("count", counts);         // std::vector<int32_t>
+    log.AddTimestampColumn("t", stamps_ns); // std::vector<int64_t>
+    log.AddStringColumn("sensor", names);   // std::vector<std::string>
+    mpl.SendTable(log);
+    mpl.RunCode("Log.groupby('sensor').x.mean()");
+\endcode
+ */
+class Table {
+public:
+  /// The type of a column, which determines its dtype in pandas.
+  enum class ColumnType : uint8_t {
+    FLOAT64, FLOAT32,
+    INT64, INT32, INT16, INT8,
+    UINT64, UINT32, UINT16, UINT8,
+    BOOL,
+    TIMESTAMP,  ///< int64 nanoseconds since the epoch
+    CATEGORY    ///< dictionary encoded strings
+  };
+
+  //--------------------------------------------------
+  /** \brief Maps a C++ element type to its ColumnType.
+   */
+  template <typename T> struct TypeOf;
+
+  //--------------------------------------------------
+  /** \brief Constructs an empty table associated with a named variable in the
+   * iPython session.
+   *
+   * \param name  the name the DataFrame will have in the ipython session.
+   */
+  explicit Table (const std::string &name) : name_{name}, rows_{0} {}
+
+  //--------------------------------------------------
+  /** \brief Appends a numeric column.  All columns must have the same
+   * length.
+   *
+   * \param name  the column name.
+   * \param values  pointer to count contiguous values.
+   * \param count  the number of values, i.e. rows.
+   */
+  template <typename T>
+  void AddColumn (const std::string &name, const T *values, size_t count) {
+    Column &column = NewColumn_(name, TypeOf<T>::value, count);
+    column.buffers.emplace_back(sizeof(T)*count);
+    std::memcpy(column.buffers.back().data(), values, sizeof(T)*count);
+  }
+
+  template <typename T>
+  void AddColumn (const std::string &name, const std::vector<T> &values) {
+    AddColumn(name, values.data(), values.size());
+  }
+
+  //--------------------------------------------------
+  /** \brief Appends a timestamp column.
+   *
+   * \param name  the column name.
+   * \param nanoseconds  nanoseconds since the Unix epoch, in UTC.
+   */
+  void AddTimestampColumn (const std::string &name,
+                           const std::vector<int64_t> &nanoseconds);
+
+  //--------------------------------------------------
+  /** \brief Appends a string column.  It is dictionary encoded, so repeated
+   * strings cost only an index each and it becomes a pandas Categorical.
+   *
+   * \param name  the column name.
+   * \param values  the strings, expected to be UTF-8.
+   */
+  void AddStringColumn (const std::string &name,
+                        const std::vector<std::string> &values);
+
+  //--------------------------------------------------
+  /** \brief Serializes everything except the column buffers, i.e. the table
+   * name, row count, and column names and types.
+   *
+   * \param buffer  the byte buffer to be serialized into.  Overwrites
+   *                previous contents.
+   */
+  void SerializeHeaderTo (std::vector<uint8_t> *buffer) const;
+
+  //--------------------------------------------------
+  /** \brief Returns the column buffers in the order they are sent after the
+   * header.  Numeric and timestamp columns have one buffer, string columns
+   * have three: int32 codes, int32 dictionary offsets and dictionary bytes.
+   */
+  std::vector<const std::vector<uint8_t>*> Buffers (void) const;
+
+  //--------------------------------------------------
+  /** \brief Returns the number of rows.
+   */
+  size_t Rows (void) const { return rows_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the number of columns.
+   */
+  size_t Cols (void) const { return columns_.size(); }
+
+  //--------------------------------------------------
+  /** \brief Returns the name of the iPython variable this table is
+   * associated with.
+   */
+  std::string Name (void) const { return name_; }
+
+private:
+  struct Column {
+    std::string name;
+    ColumnType type;
+    std::vector<std::vector<uint8_t>> buffers;
+  };
+
+  Column& NewColumn_ (const std::string &name, ColumnType type, size_t rows);
+
+  const std::string name_;
+  size_t rows_;
+  std::vector<Column> columns_;
+};
+
+template <> struct Table::TypeOf<double> {
+  static const ColumnType value = ColumnType::FLOAT64; };
+template <> struct Table::TypeOf<float> {
+  static const ColumnType value = ColumnType::FLOAT32; };
+template <> struct Table::TypeOf<int64_t> {
+  static const ColumnType value = ColumnType::INT64; };
+template <> struct Table::TypeOf<int32_t> {
+  static const ColumnType value = ColumnType::INT32; };
+template <> struct Table::TypeOf<int16_t> {
+  static const ColumnType value = ColumnType::INT16; };
+template <> struct Table::TypeOf<int8_t> {
+  static const ColumnType value = ColumnType::INT8; };
+template <> struct Table::TypeOf<uint64_t> {
+  static const ColumnType value = ColumnType::UINT64; };
+template <> struct Table::TypeOf<uint32_t> {
+  static const ColumnType value = ColumnType::UINT32; };
+template <> struct Table::TypeOf<uint16_t> {
+  static const ColumnType value = ColumnType::UINT16; };
+template <> struct Table::TypeOf<uint8_t> {
+  static const ColumnType value = ColumnType::UINT8; };
+template <> struct Table::TypeOf<bool> {
+  static const ColumnType value = ColumnType::BOOL; };
+
+} // namespace
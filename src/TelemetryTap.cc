@@ -0,0 +1,121 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <algorithm>
+#include <chrono>
+
+#include "TelemetryTap.hpp"
+
+namespace cppmpl {
+
+//======================================================================
+TelemetryTap::TelemetryTap (ThreadedClient *client, double publish_hz) :
+    client_{client},
+    period_{static_cast<int64_t>(1e9 / publish_hz)},
+    failures_{0},
+    running_{false}
+{}
+
+TelemetryTap::~TelemetryTap (void) {
+  Stop();
+}
+
+TelemetryChannel* TelemetryTap::AddChannel (const std::string &name,
+                                            size_t capacity, size_t window) {
+  if (window == 0) {
+    throw std::runtime_error("TelemetryTap window must be positive");
+  }
+  std::lock_guard<std::mutex> lock{channels_mutex_};
+  channels_.emplace_back(new TelemetryChannel{name, capacity, window});
+  scratch_.resize(std::max(scratch_.size(),
+                           channels_.back()->ring_.Capacity()));
+  return channels_.back().get();
+}
+
+void TelemetryTap::Start (void) {
+  if (!running_.exchange(true)) {
+    thread_ = std::thread{&TelemetryTap::Run_, this};
+  }
+}
+
+void TelemetryTap::Stop (void) {
+  if (running_.exchange(false)) {
+    thread_.join();
+  }
+}
+
+std::string TelemetryTap::LastError (void) const {
+  std::lock_guard<std::mutex> lock{error_mutex_};
+  return last_error_;
+}
+
+void TelemetryTap::Run_ (void) {
+  auto next = std::chrono::steady_clock::now();
+  while (running_.load()) {
+    next += period_;
+    std::this_thread::sleep_until(next);
+    Publish_();
+  }
+  Publish_();
+}
+
+void TelemetryTap::Drain_ (TelemetryChannel *channel) {
+  // Move everything in the ring into the rolling window
+  const size_t window = channel->window_.size();
+  size_t count;
+  while ((count = channel->ring_.Pop(scratch_.data(), scratch_.size()))) {
+    for (size_t i = 0; i != count; ++i) {
+      channel->window_[channel->next_] = scratch_[i];
+      channel->next_ = (channel->next_ + 1) % window;
+    }
+    channel->filled_ = std::min(window, channel->filled_ + count);
+    channel->dirty_ = true;
+  }
+}
+
+void TelemetryTap::Publish_ (void) {
+  std::lock_guard<std::mutex> lock{channels_mutex_};
+  for (auto &channel : channels_) {
+    Drain_(channel.get());
+  }
+
+  // Skip this tick if the kernel has not taken the last one yet; the
+  // windows keep rolling so nothing is queued up.
+  for (auto &publish : publishing_) {
+    if (publish.wait_for(std::chrono::seconds(0))
+        != std::future_status::ready) {
+      return;
+    }
+  }
+  for (auto &publish : publishing_) {
+    try {
+      publish.get();
+    } catch (const std::exception &e) {
+      ++failures_;
+      std::lock_guard<std::mutex> lock{error_mutex_};
+      last_error_ = e.what();
+    }
+  }
+  publishing_.clear();
+
+  for (auto &channel : channels_) {
+    if (!channel->dirty_) {
+      continue;
+    }
+    // Unroll the window into time order, oldest first
+    const size_t window = channel->window_.size();
+    const size_t start = (channel->next_ + window - channel->filled_) % window;
+    std::vector<NumpyArray::dtype> ordered(channel->filled_);
+    for (size_t i = 0; i != channel->filled_; ++i) {
+      ordered[i] = channel->window_[(start + i) % window];
+    }
+    publishing_.push_back(
+        client_->SendData(NumpyArray{channel->Name(), ordered}));
+    channel->dirty_ = false;
+  }
+}
+
+} // namespace
@@ -0,0 +1,167 @@
+// 
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+// 
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SpscRing.hpp"
+#include "ThreadedClient.hpp"
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief One real-time signal published by a TelemetryTap.
+ *
+ * Push is safe to call from a hard real-time loop: it is wait-free, does not
+ * allocate and makes no system calls.  If the tap falls behind, samples are
+ * dropped and counted rather than ever blocking the writer.
+ */
+class TelemetryChannel {
+public:
+  //--------------------------------------------------
+  /** \brief Records one sample.  Only one thread may push to a channel.
+   *
+   * \returns false if the sample was dropped because the ring was full.
+   */
+  bool Push (double sample) { return ring_.Push(sample); }
+
+  //--------------------------------------------------
+  /** \brief Returns the number of samples dropped so far.
+   */
+  uint64_t Overruns (void) const { return ring_.Overruns(); }
+
+  //--------------------------------------------------
+  /** \brief Returns the number of samples recorded so far.
+   */
+  uint64_t Samples (void) const { return ring_.Pushed(); }
+
+  //--------------------------------------------------
+  /** \brief Returns the name of the iPython variable this channel is
+   * published as.
+   */
+  std::string Name (void) const { return name_; }
+
+private:
+  friend class TelemetryTap;
+
+  TelemetryChannel (const std::string &name, size_t capacity, size_t window)
+    : name_{name}, ring_{capacity}, window_(window), filled_{0}, next_{0},
+      dirty_{false}
+  {}
+
+  const std::string name_;
+  SpscRing<double> ring_;
+
+  // Rolling window of the latest samples, owned by the drain thread.
+  std::vector<double> window_;
+  size_t filled_;
+  size_t next_;
+  bool dirty_;
+};
+
+//======================================================================
+/** \brief Publishes real-time signals to the iPython kernel without ever
+ * blocking the real-time thread.
+ *
+ * Each channel has a preallocated ring that the real-time thread writes
+ * with TelemetryChannel::Push.  A background thread drains the rings at a
+ * fixed rate and sends the latest window of samples of each channel as a
+ * NumpyArray through a ThreadedClient.  If the previous publish has not
+ * gone through yet, that tick is skipped, so a slow kernel lowers the
+ * publish rate instead of queueing.  Publishes that fail are counted, and
+ * the reason for the latest kept, for Failures and LastError.
+ *
+ * Usage:
+\code
+    ThreadedClient mpl{"/path/to/kernel-NNN.json"};
+    TelemetryTap tap{&mpl, 20.0};
+    TelemetryChannel *error = tap.AddChannel("Error", 4096, 10000);
+    tap.Start();
+
+    // In the 10 kHz loop
+    error->Push(setpoint - measured);
+\endcode
+ */
+class TelemetryTap {
+public:
+  //--------------------------------------------------
+  /** \param client  the client to publish through.  Must outlive the tap.
+   * \param publish_hz  how many times a second to publish.
+   */
+  TelemetryTap (ThreadedClient *client, double publish_hz);
+
+  //--------------------------------------------------
+  /** \brief Stops publishing.
+   */
+  ~TelemetryTap (void);
+
+  //--------------------------------------------------
+  /** \brief Creates a channel.  Allocates, so call it during setup rather
+   * than from the real-time thread.
+   *
+   * \param name  the name of the array in the iPython session.
+   * \param capacity  how many samples the ring holds between drains.
+   * \param window  how many of the latest samples are published.
+   *
+   * \throws std::runtime_error  if capacity or window is zero.
+   *
+   * \returns the channel, owned by the tap.
+   */
+  TelemetryChannel* AddChannel (const std::string &name, size_t capacity,
+                                size_t window);
+
+  //--------------------------------------------------
+  /** \brief Starts the drain thread.
+   */
+  void Start (void);
+
+  //--------------------------------------------------
+  /** \brief Stops the drain thread after one last drain.
+   */
+  void Stop (void);
+
+  //--------------------------------------------------
+  /** \brief Returns how many arrays the kernel failed to take so far.
+   */
+  uint64_t Failures (void) const { return failures_.load(); }
+
+  //--------------------------------------------------
+  /** \brief Returns why the latest failed publish failed, or an empty
+   * string if none has.
+   */
+  std::string LastError (void) const;
+
+private:
+  void Run_ (void);
+  void Drain_ (TelemetryChannel *channel);
+  void Publish_ (void);
+
+  ThreadedClient *client_;
+  const std::chrono::nanoseconds period_;
+
+  std::mutex channels_mutex_;
+  std::vector<std::unique_ptr<TelemetryChannel>> channels_;
+
+  std::vector<double> scratch_;
+  // One per channel sent in the last tick that sent any
+  std::vector<std::future<void>> publishing_;
+  std::atomic<uint64_t> failures_;
+  mutable std::mutex error_mutex_;
+  std::string last_error_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+};
+
+} // namespace
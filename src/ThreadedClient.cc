@@ -0,0 +1,184 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <memory>
+
+#include "ThreadedClient.hpp"
+
+namespace cppmpl {
+
+//======================================================================
+ThreadedClient::ThreadedClient (const std::string &config_filename,
+                                const TransportOptions &options) :
+    config_filename_{config_filename},
+    options_{options},
+    upBulk_{new Worker{config_filename, options}}
+{
+  // Connect here so that errors reach the caller.  Starting the thread is a
+  // full barrier, after which only the I/O thread touches the sockets.
+  upBulk_->mpl.Connect();
+  upBulk_->thread = std::thread{&ThreadedClient::Run_, upBulk_.get()};
+}
+
+ThreadedClient::~ThreadedClient (void) {
+  Stop_(upBulk_.get());
+  if (upUrgent_) {
+    Stop_(upUrgent_.get());
+  }
+}
+
+std::future<void> ThreadedClient::Identify (const std::string &client_name,
+                                            const std::string &prefix,
+                                            double weight) {
+  Task hello = [client_name, prefix, weight] (CppMatplotlib &mpl) {
+    mpl.Identify(client_name, prefix, weight);
+  };
+  std::lock_guard<std::mutex> lock{hello_mutex_};
+  hello_ = hello;
+  if (upUrgent_) {
+    Submit(hello, Lane::URGENT);
+  }
+  return Submit(hello, Lane::BULK);
+}
+
+std::future<void> ThreadedClient::SendData (NumpyArray data, Lane lane) {
+  std::vector<uint8_t> buffer(data.WireSize());
+  data.SerializeTo(&buffer);
+  SpillStore::Handle payload = spill_.Admit(std::move(buffer));
+
+  SpillStore *store = &spill_;
+  Task send = [store, payload] (CppMatplotlib &mpl) {
+    try {
+      SpillStore::View view = store->Acquire(payload);
+      mpl.SendSerialized(view.data, view.size);
+    } catch (...) {
+      store->Release(payload);
+      throw;
+    }
+    store->Release(payload);
+  };
+  try {
+    return Submit(std::move(send), lane);
+  } catch (...) {
+    // The store still has the payload queued, e.g. when the urgent lane
+    // could not connect, and nothing else would take it off
+    spill_.Release(payload);
+    throw;
+  }
+}
+
+std::shared_future<void> ThreadedClient::SendLatest (const NumpyArray &data,
+                                                     Lane lane) {
+  LatestSlot *slot;
+  {
+    std::lock_guard<std::mutex> lock{slots_mutex_};
+    std::unique_ptr<LatestSlot> &entry = slots_[data.Name()];
+    if (!entry) {
+      entry.reset(new LatestSlot{lane});
+    }
+    slot = entry.get();
+  }
+
+  std::lock_guard<std::mutex> lock{slot->mutex};
+  data.SerializeTo(&slot->pending);
+  if (!slot->queued) {
+    // Whatever is pending when the I/O thread gets here is what goes
+    slot->queued = true;
+    slot->done = Submit([slot] (CppMatplotlib &mpl) {
+      {
+        std::lock_guard<std::mutex> lock{slot->mutex};
+        slot->pending.swap(slot->sending);
+        slot->queued = false;
+      }
+      mpl.SendSerialized(slot->sending.data(), slot->sending.size());
+    }, slot->lane).share();
+  }
+  return slot->done;
+}
+
+std::future<void> ThreadedClient::RunCode (std::string code, Lane lane) {
+  auto shared = std::make_shared<std::string>(std::move(code));
+  return Submit([shared] (CppMatplotlib &mpl) { mpl.RunCode(*shared); },
+                lane);
+}
+
+std::future<void> ThreadedClient::Flush (Lane lane) {
+  return Submit([] (CppMatplotlib&) {}, lane);
+}
+
+std::future<void> ThreadedClient::Submit (Task task, Lane lane) {
+  Worker &worker = Lane_(lane);
+  Request request;
+  request.task = std::move(task);
+  std::future<void> done = request.done.get_future();
+  worker.queue.Push(std::move(request));
+
+  if (worker.sleeping.load()) {
+    std::lock_guard<std::mutex> lock{worker.mutex};
+    worker.wake.notify_one();
+  }
+  return done;
+}
+
+ThreadedClient::Worker& ThreadedClient::Lane_ (Lane lane) {
+  if (lane == Lane::BULK) {
+    return *upBulk_;
+  }
+
+  // The urgent connection opens on first use.  If that throws, the next
+  // urgent request tries again.
+  std::call_once(urgent_once_, [this] {
+    std::unique_ptr<Worker> worker{new Worker{config_filename_, options_}};
+    worker->mpl.Connect();
+    worker->mpl.SetUrgent(true);
+    std::lock_guard<std::mutex> lock{hello_mutex_};
+    if (hello_) {
+      hello_(worker->mpl);
+    }
+    worker->thread = std::thread{&ThreadedClient::Run_, worker.get()};
+    upUrgent_ = std::move(worker);
+  });
+  return *upUrgent_;
+}
+
+void ThreadedClient::Stop_ (Worker *worker) {
+  {
+    std::lock_guard<std::mutex> lock{worker->mutex};
+    worker->stopping = true;
+  }
+  worker->wake.notify_one();
+  worker->thread.join();
+}
+
+void ThreadedClient::Run_ (Worker *worker) {
+  Request request;
+  while (true) {
+    if (worker->queue.Pop(&request)) {
+      try {
+        request.task(worker->mpl);
+        request.done.set_value();
+      } catch (...) {
+        request.done.set_exception(std::current_exception());
+      }
+      continue;
+    }
+
+    // Nothing to do.  Announce that we are going to sleep before the last
+    // look at the queue, so a producer either sees sleeping or we see its
+    // request.
+    std::unique_lock<std::mutex> lock{worker->mutex};
+    worker->sleeping.store(true);
+    worker->wake.wait(lock, [worker] {
+      return worker->stopping || !worker->queue.Empty();
+    });
+    worker->sleeping.store(false);
+    if (worker->stopping && worker->queue.Empty()) {
+      break;
+    }
+  }
+}
+
+} // namespace
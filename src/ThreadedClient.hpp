@@ -0,0 +1,209 @@
+// 
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+// 
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "cpp_mpl.hpp"
+#include "MpscQueue.hpp"
+#include "SpillStore.hpp"
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief A CppMatplotlib that may be used from many threads at once.
+ *
+ * CppMatplotlib's sockets are not thread-safe, so here a single I/O thread
+ * owns them.  Producer threads push requests onto a lock-free queue and
+ * carry on, never contending on a lock; each producer's requests run in the
+ * order it submitted them.  Every call returns a future that becomes ready
+ * when the request has been carried out, or holds its exception.
+ *
+ * Requests go in one of two lanes.  Bulk requests are the default.  Urgent
+ * ones, such as closing figures or live updates, have a connection and I/O
+ * thread of their own, opened on first use, and the listener serves them
+ * ahead of bulk ones.  Since large frames are sent in chunks, an urgent
+ * request waits for at most one chunk of a bulk transfer in flight.
+ *
+ * Arrays queued by SendData can be held to a memory budget, so a slow or
+ * unreachable kernel makes producers spill to disk rather than run the
+ * process out of memory.
+ *
+ * Usage:
+\code
+    ThreadedClient mpl{"/path/to/kernel-NNN.json"};
+
+    // From any number of worker threads
+    mpl.SendData(NumpyArray{"Result" + std::to_string(id), values});
+
+    // And wait for everything submitted so far to be done
+    mpl.Flush().wait();
+
+    // Overtaking any bulk transfers still in flight
+    mpl.RunCode("close('all')", ThreadedClient::Lane::URGENT);
+\endcode
+ */
+class ThreadedClient {
+public:
+  /// A unit of work run on the I/O thread against the wrapped connection.
+  typedef std::function<void(CppMatplotlib &mpl)> Task;
+
+  /// The connection a request goes over.  Requests in different lanes may
+  /// be carried out in any order relative to each other.
+  enum class Lane {BULK, URGENT};
+
+  //--------------------------------------------------
+  /** \brief Connects to the iPython kernel, as CppMatplotlib::Connect, and
+   * starts the I/O thread.
+   *
+   * \param config_filename  the kernel's JSON connection file.
+   * \param options  socket settings for the connections.
+   */
+  explicit ThreadedClient (
+      const std::string &config_filename,
+      const TransportOptions &options = TransportOptions{});
+
+  //--------------------------------------------------
+  /** \brief Carries out every request already submitted, then stops the I/O
+   * thread.
+   */
+  ~ThreadedClient (void);
+
+  ThreadedClient (const ThreadedClient&) = delete;
+  ThreadedClient& operator= (const ThreadedClient&) = delete;
+
+  //--------------------------------------------------
+  /** \brief Introduces this client to the listener, as
+   * CppMatplotlib::Identify, over both lanes.
+   */
+  std::future<void> Identify (const std::string &client_name,
+                              const std::string &prefix = "",
+                              double weight = 1.0);
+
+  //--------------------------------------------------
+  /** \brief Queues an array to be sent, as CppMatplotlib::SendData.  The
+   * array is serialized and freed before this returns, and the serialized
+   * copy counts against the memory budget until it has been sent.
+   *
+   * \throws std::runtime_error  if over budget and the spill file cannot
+   *                             be written.
+   */
+  std::future<void> SendData (NumpyArray data, Lane lane = Lane::BULK);
+
+  //--------------------------------------------------
+  /** \brief Queues an array to be sent, replacing any version of the same
+   * name that is still waiting to go.
+   *
+   * For live displays, where only the newest value matters: when the kernel
+   * falls behind, intermediate versions are dropped instead of queued, so
+   * what it shows is at most one update stale.  Each name keeps two reused
+   * buffers, so memory is bounded by the number of names.  The array is
+   * serialized before this returns.
+   *
+   * A name is sent over the lane of its first SendLatest from then on, as
+   * its buffers may only be in use by one I/O thread at a time.
+   *
+   * \returns a future shared by every call conflated into the same send.
+   */
+  std::shared_future<void> SendLatest (const NumpyArray &data,
+                                       Lane lane = Lane::BULK);
+
+  //--------------------------------------------------
+  /** \brief Queues code to be run, as CppMatplotlib::RunCode.
+   */
+  std::future<void> RunCode (std::string code, Lane lane = Lane::BULK);
+
+  //--------------------------------------------------
+  /** \brief Queues an arbitrary task, e.g. SendTable, for the I/O thread.
+   */
+  std::future<void> Submit (Task task, Lane lane = Lane::BULK);
+
+  //--------------------------------------------------
+  /** \brief Returns a future that is ready once everything this thread
+   * submitted to the lane before the call has been carried out.
+   */
+  std::future<void> Flush (Lane lane = Lane::BULK);
+
+  //--------------------------------------------------
+  /** \brief Limits the memory taken by arrays queued or being sent by
+   * SendData.  Beyond it, the oldest queued arrays are written to an
+   * unlinked file in $TMPDIR (or /tmp) and mapped back in to be sent.
+   *
+   * \param bytes  the budget, 0 for no limit, which is the default.
+   */
+  void SetMemoryBudget (size_t bytes) { spill_.SetBudget(bytes); }
+
+  //--------------------------------------------------
+  /** \brief Returns how much of the memory budget is used and how much has
+   * been spilled to disk.
+   */
+  SpillStore::Stats MemoryStats (void) const { return spill_.GetStats(); }
+
+private:
+  struct Request {
+    Task task;
+    std::promise<void> done;
+  };
+
+  // A connection and the I/O thread that owns it.  The thread only takes
+  // the mutex to go to sleep when the queue is empty; producers only take
+  // it to wake the thread.
+  struct Worker {
+    Worker (const std::string &config_filename,
+            const TransportOptions &options)
+      : mpl{config_filename, options}, sleeping{false}, stopping{false} {}
+
+    CppMatplotlib mpl;
+    MpscQueue<Request> queue;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::atomic<bool> sleeping;
+    bool stopping;
+    std::thread thread;
+  };
+
+  // The newest unsent version of one name, and the buffer it was last sent
+  // from.  The two are swapped rather than reallocated.
+  struct LatestSlot {
+    explicit LatestSlot (Lane slot_lane) : lane{slot_lane} {}
+
+    const Lane lane;
+    std::mutex mutex;
+    std::vector<uint8_t> pending;
+    std::vector<uint8_t> sending;
+    bool queued = false;
+    std::shared_future<void> done;
+  };
+
+  Worker& Lane_ (Lane lane);
+  static void Run_ (Worker *worker);
+  static void Stop_ (Worker *worker);
+
+  const std::string config_filename_;
+  const TransportOptions options_;
+  std::mutex slots_mutex_;
+  std::unordered_map<std::string, std::unique_ptr<LatestSlot>> slots_;
+  SpillStore spill_;
+
+  std::unique_ptr<Worker> upBulk_;
+  std::once_flag urgent_once_;
+  std::unique_ptr<Worker> upUrgent_;
+
+  // The last Identify, repeated when the urgent lane opens
+  std::mutex hello_mutex_;
+  Task hello_;
+};
+
+} // namespace
@@ -0,0 +1,51 @@
+// 
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+// 
+
+#pragma once
+
+#include <cstddef>
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief Socket settings for the connections to the kernel.
+ *
+ * The defaults suit a kernel on the same machine: the data channel then uses
+ * a Unix domain socket instead of TCP.  For remote kernels larger kernel
+ * buffers help keep big arrays streaming over high latency links.
+ */
+struct TransportOptions {
+  /// Send data as comm messages on the shell socket when the kernel speaks
+  /// messaging protocol 5, rather than to a listener thread
+  bool prefer_comm = true;
+
+  /// Use an ipc:// data channel when the kernel is on this host
+  bool prefer_ipc = true;
+
+  /// Number of zmq I/O threads per connection
+  int io_threads = 1;
+
+  /// Messages queued per socket before sends block, 0 for no limit
+  int send_hwm = 1000;
+  int receive_hwm = 1000;
+
+  /// OS socket buffer sizes in bytes, 0 to leave the OS default
+  int send_buffer = 4 << 20;
+  int receive_buffer = 4 << 20;
+
+  /// Keep idle TCP connections to remote kernels alive through NATs
+  bool tcp_keepalive = true;
+
+  /// Frames larger than this many bytes are sent in chunks, between which
+  /// the kernel can serve other requests, 0 to send them whole
+  size_t chunk_bytes = 16 << 20;
+
+  /// Milliseconds to wait for the kernel to reply to a comm message before
+  /// giving up on it, -1 to wait forever
+  long reply_timeout_ms = 60000;
+};
+
+} // namespace
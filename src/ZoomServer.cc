@@ -0,0 +1,127 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <vector>
+
+#include <zmq.hpp>
+
+#include "ZoomServer.hpp"
+#include "wire_util.hpp"
+
+namespace cppmpl {
+
+static std::string DefaultEndpoint (void) {
+  return "ipc://" + TempDirectory() + "/cpp-matplotlib-zoom-" +
+      std::to_string(getpid());
+}
+
+//======================================================================
+ZoomServer::ZoomServer (const std::string &endpoint,
+                        const std::string &advertised) :
+    endpoint_{endpoint.empty() ? DefaultEndpoint() : endpoint},
+    advertised_{advertised.empty() ? endpoint_ : advertised},
+    upContext_{new zmq::context_t(1)},
+    upSocket_{new zmq::socket_t(*upContext_, ZMQ_REP)},
+    stopping_{false}
+{
+  // Bound here so a bad endpoint throws to the caller.  The socket is only
+  // used by the thread from then on.
+  upSocket_->bind(endpoint_.c_str());
+  thread_ = std::thread(&ZoomServer::Serve_, this);
+}
+
+ZoomServer::~ZoomServer (void) {
+  stopping_ = true;
+  thread_.join();
+  upSocket_.reset();
+  if (endpoint_.compare(0, 6, "ipc://") == 0) {
+    unlink(endpoint_.c_str() + 6);
+  }
+}
+
+void ZoomServer::Add (const SeriesPyramid *pyramid) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  pyramids_[pyramid->Name()] = pyramid;
+}
+
+void ZoomServer::Remove (const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  pyramids_.erase(name);
+}
+
+void ZoomServer::Serve_ (void) {
+  zmq::socket_t &socket = *upSocket_;
+  zmq::pollitem_t item{static_cast<void*>(socket), 0, ZMQ_POLLIN, 0};
+  while (!stopping_) {
+    try {
+      zmq::poll(&item, 1, 100);
+    } catch (const zmq::error_t &e) {
+      if (e.num() != EINTR) {
+        throw;
+      }
+      continue;
+    }
+    if (!(item.revents & ZMQ_POLLIN)) {
+      continue;
+    }
+
+    // Requests are ["zoom", name, numbers], the numbers being first, last
+    // and pixels packed as uint64, uint64, uint32.
+    std::vector<zmq::message_t> request;
+    do {
+      request.emplace_back();
+      socket.recv(&request.back());
+    } while (request.back().more());
+
+    std::string status;
+    SeriesPyramid::View view{0, 1, 0, {}, {}};
+    if (request.size() != 3 || request[2].size() != 20) {
+      status = "Malformed zoom request";
+    } else {
+      const std::string name{static_cast<const char*>(request[1].data()),
+                             request[1].size()};
+      uint64_t first, last;
+      uint32_t pixels;
+      const char *numbers = static_cast<const char*>(request[2].data());
+      std::memcpy(&first, numbers, sizeof(first));
+      std::memcpy(&last, numbers + 8, sizeof(last));
+      std::memcpy(&pixels, numbers + 16, sizeof(pixels));
+
+      // Queried with the registry locked, so Remove waits for it
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto found = pyramids_.find(name);
+      if (found == pyramids_.end()) {
+        status = "No series named " + name;
+      } else {
+        view = found->second->Query(first, last, pixels);
+        status = "Success";
+      }
+    }
+
+    // Replies are [status, header, mins, maxs], the header being the level,
+    // block, first sample and number of points.
+    if (status != "Success") {
+      socket.send(status.data(), status.size(), 0);
+      continue;
+    }
+    std::vector<uint8_t> header;
+    Append(view.level, &header);
+    Append(view.block, &header);
+    Append(view.first, &header);
+    Append(static_cast<uint64_t>(view.mins.size()), &header);
+    socket.send(status.data(), status.size(), ZMQ_SNDMORE);
+    socket.send(header.data(), header.size(), ZMQ_SNDMORE);
+    socket.send(view.mins.data(), view.mins.size() * sizeof(double),
+                ZMQ_SNDMORE);
+    socket.send(view.maxs.data(), view.maxs.size() * sizeof(double), 0);
+  }
+}
+
+} // namespace
@@ -0,0 +1,80 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "SeriesPyramid.hpp"
+
+namespace zmq {
+class context_t;
+class socket_t;
+}
+
+namespace cppmpl {
+
+//======================================================================
+/** \brief Answers the kernel's requests for windows of SeriesPyramids, from
+ * a thread of its own.
+ *
+ * The data channel only carries requests from this process to the kernel,
+ * so the kernel asks for zoomed views over a socket of its own that this
+ * server binds.  It must outlive the plots that zoom through it; afterwards
+ * they keep showing whatever they last fetched.
+ */
+class ZoomServer {
+public:
+  //--------------------------------------------------
+  /** \brief Binds the server's socket and starts serving.
+   *
+   * \param endpoint  the ZeroMQ endpoint to bind.  By default a Unix domain
+   *                  socket in $TMPDIR (or /tmp), for a kernel on this host.
+   * \param advertised  the endpoint the kernel should connect to, if not
+   *                    the one bound, e.g. "tcp://myhost:5599" when bound
+   *                    to all interfaces.
+   */
+  explicit ZoomServer (const std::string &endpoint = "",
+                       const std::string &advertised = "");
+  ~ZoomServer (void);
+
+  //--------------------------------------------------
+  /** \brief Serves a pyramid under its name, replacing any of the same
+   * name.  The pyramid must outlive the server or be removed first.
+   */
+  void Add (const SeriesPyramid *pyramid);
+
+  //--------------------------------------------------
+  /** \brief Stops serving the pyramid with this name.
+   */
+  void Remove (const std::string &name);
+
+  //--------------------------------------------------
+  /** \brief Returns the endpoint the kernel connects to.
+   */
+  const std::string& Endpoint (void) const { return advertised_; }
+
+private:
+  void Serve_ (void);
+
+  const std::string endpoint_;
+  const std::string advertised_;
+  std::unique_ptr<zmq::context_t> upContext_;
+  std::unique_ptr<zmq::socket_t> upSocket_;
+
+  std::mutex mutex_;
+  std::unordered_map<std::string, const SeriesPyramid*> pyramids_;
+
+  std::atomic<bool> stopping_;
+  std::thread thread_;
+};
+
+} // namespace
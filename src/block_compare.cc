@@ -0,0 +1,43 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "block_compare.hpp"
+
+namespace cppmpl {
+
+bool BlocksEqual (const uint8_t *a, const uint8_t *b, size_t size) {
+  size_t i = 0;
+#ifdef __SSE2__
+  // Four 16 byte lanes per step, and-ing the equality masks so there is one
+  // branch per 64 bytes.
+  for (; i + 64 <= size; i += 64) {
+    const __m128i *va = reinterpret_cast<const __m128i*>(a + i);
+    const __m128i *vb = reinterpret_cast<const __m128i*>(b + i);
+    __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128(va + 0),
+                                 _mm_loadu_si128(vb + 0));
+    __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128(va + 1),
+                                 _mm_loadu_si128(vb + 1));
+    __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128(va + 2),
+                                 _mm_loadu_si128(vb + 2));
+    __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128(va + 3),
+                                 _mm_loadu_si128(vb + 3));
+    __m128i eq = _mm_and_si128(_mm_and_si128(eq0, eq1),
+                               _mm_and_si128(eq2, eq3));
+    if (_mm_movemask_epi8(eq) != 0xffff) {
+      return false;
+    }
+  }
+#endif
+  return std::memcmp(a + i, b + i, size - i) == 0;
+}
+
+} // namespace
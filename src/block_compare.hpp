@@ -0,0 +1,27 @@
+// 
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+// 
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cppmpl {
+
+//--------------------------------------------------
+/** \brief Returns whether two equally sized blocks of memory hold the same
+ * bytes.
+ *
+ * Uses SSE2 when the compiler targets it, comparing 64 bytes per step, and
+ * falls back to memcmp otherwise.
+ *
+ * \param a  the first block.
+ * \param b  the second block.
+ * \param size  the number of bytes in each block.
+ */
+bool BlocksEqual(const uint8_t *a, const uint8_t *b, size_t size);
+
+} // namespace
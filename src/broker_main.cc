@@ -0,0 +1,46 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+// Keeps a kernel connection open for short-lived processes to attach to
+// with CppMatplotlib::Attach, e.g.
+//
+//   $ cpp-matplotlib-broker ~/.ipython/.../kernel-NNN.json &
+//   $ ./many-tiny-plotters
+
+#include <csignal>
+#include <iostream>
+
+#include "Broker.hpp"
+
+static cppmpl::Broker *g_broker = nullptr;
+
+static void OnSignal(int) {
+  if (g_broker) {
+    g_broker->Stop();
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " /path/to/kernel-PID.json"
+      << " [ipc://endpoint]" << std::endl;
+    exit(-1);
+  }
+
+  const std::string endpoint = argc > 2 ? std::string{argv[2]}
+                                        : cppmpl::DefaultBrokerEndpoint();
+  cppmpl::Broker broker{argv[1], endpoint};
+  g_broker = &broker;
+  std::signal(SIGINT, OnSignal);
+  std::signal(SIGTERM, OnSignal);
+
+  std::cout << "Serving " << argv[1] << " at " << broker.Endpoint()
+    << std::endl;
+  broker.Run();
+  g_broker = nullptr;
+
+  return 0;
+}
@@ -9,15 +9,32 @@
 #include <exception>
 #include <memory>
 #include <random>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+#include "AffineAxis.hpp"
+#include "DeltaArray.hpp"
+#include "DensityGrid.hpp"
+#include "ExecutionProfile.hpp"
+#include "ImageStream.hpp"
+#include "QuantizedArray.hpp"
+#include "SeriesPyramid.hpp"
+#include "SessionLog.hpp"
+#include "SparseMatrix.hpp"
+#include "Table.hpp"
+#include "TransportOptions.hpp"
+#include "ZoomServer.hpp"
+
 namespace cppmpl {
 
 // Forward declarations
 struct IPyKernelConfig;
 class IPythonSession;
-class RequestSink;
+class DataChannel;
+class ContentCache;
+class Broker;
 
 // Reads an entire file into a string
 //--------------------------------------------------
@@ -30,6 +47,12 @@ class RequestSink;
  */
 std::string LoadFile(std::string filename);
 
+//--------------------------------------------------
+/** \brief Returns where a Broker listens unless told otherwise: a Unix
+ * domain socket in $TMPDIR (or /tmp) private to this user.
+ */
+std::string DefaultBrokerEndpoint(void);
+
 
 //======================================================================
 /** \brief Container class to represent a 2D Numpy array.
@@ -168,6 +191,152 @@ private:
   uint32_t cols_;
 };
 
+//======================================================================
+/** \brief An n-dimensional array fetched from the iPython kernel, holding the
+ * raw buffer exactly as numpy had it.
+ *
+ * The element type is only known at runtime, so the data is accessed through
+ * Data<T>(), which checks that T matches the numpy dtype.
+ *
+ * Usage:
+\code
+    FetchedArray fit = mpl.FetchData("coefficients");
+    if (fit.Is<double>()) {
+      const double *values = fit.Data<double>();
+      // ... fit.Size() values in row major order ...
+    }
+\endcode
+ */
+class FetchedArray {
+public:
+  /// The kind of numpy dtype, as in numpy.dtype.kind.
+  enum class Kind : char {FLOAT = 'f', INT = 'i', UINT = 'u', BOOL = 'b'};
+
+  //--------------------------------------------------
+  /** \brief Wraps a received buffer.  Normally only called by
+   * CppMatplotlib::FetchData.
+   *
+   * \param name  the name of the variable in the iPython session.
+   * \param kind  the kind of element.
+   * \param item_size  the size of one element in bytes.
+   * \param shape  the size of each dimension.
+   * \param data  the row major buffer of Size()*item_size bytes.
+   */
+  FetchedArray (const std::string &name, Kind kind, size_t item_size,
+                const std::vector<size_t> &shape,
+                std::shared_ptr<const uint8_t> data)
+    : name_{name}, kind_{kind}, item_size_{item_size}, shape_{shape},
+      data_{data}
+  {}
+
+  //--------------------------------------------------
+  /** \brief Returns whether the elements are of type T.
+   */
+  template <typename T>
+  bool Is (void) const {
+    if (sizeof(T) != item_size_) {
+      return false;
+    }
+    switch (kind_) {
+    case Kind::FLOAT: return std::is_floating_point<T>::value;
+    case Kind::INT:   return std::is_integral<T>::value
+                        && std::is_signed<T>::value;
+    case Kind::UINT:  return std::is_integral<T>::value
+                        && std::is_unsigned<T>::value
+                        && !std::is_same<T, bool>::value;
+    case Kind::BOOL:  return std::is_same<T, bool>::value;
+    }
+    return false;
+  }
+
+  //--------------------------------------------------
+  /** \brief Returns a pointer to the row major elements.
+   *
+   * \throws std::runtime_error  if T does not match the element type.
+   */
+  template <typename T>
+  const T* Data (void) const {
+    if (!Is<T>()) {
+      throw std::runtime_error("FetchedArray type mismatch for " + name_);
+    }
+    return reinterpret_cast<const T*>(data_.get());
+  }
+
+  //--------------------------------------------------
+  /** \brief Returns the kind of element held.
+   */
+  Kind ElementKind (void) const { return kind_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the size of one element in bytes.
+   */
+  size_t ItemSize (void) const { return item_size_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the size of each dimension, empty for a scalar.
+   */
+  const std::vector<size_t>& Shape (void) const { return shape_; }
+
+  //--------------------------------------------------
+  /** \brief Returns the total number of elements.
+   */
+  size_t Size (void) const;
+
+  //--------------------------------------------------
+  /** \brief Returns the name of the iPython variable this array came from.
+   */
+  std::string Name (void) const { return name_; }
+
+private:
+  std::string name_;
+  Kind kind_;
+  size_t item_size_;
+  std::vector<size_t> shape_;
+  std::shared_ptr<const uint8_t> data_;
+};
+
+//======================================================================
+/** \brief Names a variable in the iPython session when passed as an argument
+ * to CppMatplotlib::Invoke, as opposed to a string value.
+ */
+struct VariableName {
+  explicit VariableName (const std::string &variable_name)
+    : name{variable_name} {}
+
+  std::string name;
+};
+
+//--------------------------------------------------
+/** \brief Returns python source for a value, used to build the small call
+ * made by CppMatplotlib::Invoke.
+ */
+std::string PythonLiteral(double value);
+std::string PythonLiteral(bool value);
+std::string PythonLiteral(const std::string &value);
+std::string PythonLiteral(const char *value);
+std::string PythonLiteral(const VariableName &value);
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value, std::string>::type
+PythonLiteral(T value) {
+  return std::to_string(value);
+}
+
+//======================================================================
+/** \brief Handle to a code snippet compiled once in the iPython kernel by
+ * CppMatplotlib::Prepare.
+ */
+class PreparedCode {
+public:
+  /// The key the compiled snippet is stored under in the kernel.
+  explicit PreparedCode (const std::string &key) : key_{key} {}
+
+  std::string Key (void) const { return key_; }
+
+private:
+  std::string key_;
+};
+
 //======================================================================
 /** \brief Interface between C++ and an IPython kernel with the pylab
  * environment.
@@ -199,10 +368,29 @@ public:
   //----------------------------------------------------------------------
   /** \brief Create a CppMatplotlib object that is configured to connect to
    * the iPython kernel as specified in the config_filename JSON file.
+   *
+   * \param options  socket settings for the shell and data connections.
    */
-  explicit CppMatplotlib (const std::string &config_filename);
+  explicit CppMatplotlib (const std::string &config_filename,
+                          const TransportOptions &options = TransportOptions{});
   CppMatplotlib (CppMatplotlib &&other);
 
+  //----------------------------------------------------------------------
+  /** \brief Creates a CppMatplotlib that works through a running Broker
+   * instead of connecting to the kernel itself.
+   *
+   * There is no kernel config to parse and no Connect to call, attaching
+   * only connects a socket, so it suits processes that plot one thing and
+   * exit.  Everything but SetProfiling and LastProfile works as it would
+   * over a direct connection.
+   *
+   * \param endpoint  where the broker listens.
+   * \param options  socket settings for the connection to the broker.
+   */
+  static CppMatplotlib Attach (
+      const std::string &endpoint = DefaultBrokerEndpoint(),
+      const TransportOptions &options = TransportOptions{});
+
   //----------------------------------------------------------------------
   // Note: Must declare destructor here and define it in the .cc file so it is
   // not implicitly inline, which allows the use of unique_ptrs with forward
@@ -211,10 +399,38 @@ public:
 
   //----------------------------------------------------------------------
   /** \brief Connects to the ipython kernel according to the configuration
-   * given to the constructor.
+   * given to the constructor.  Does nothing when attached to a Broker.
+   *
+   * The data channel uses a Unix domain socket if the kernel is on this host
+   * and the options allow it, otherwise TCP to the kernel's address.
    */
   void Connect (void);
 
+  //----------------------------------------------------------------------
+  /** \brief Introduces this process to a listener shared by several
+   * clients.  Call after Connect.
+   *
+   * \param client_name  a name for this client, for display in the kernel.
+   * \param prefix  prepended to the name of every variable this client
+   *                sends, so clients feeding the same kernel don't collide.
+   * \param weight  this client's share of the listener relative to other
+   *                clients when they are all busy.
+   */
+  void Identify (const std::string &client_name,
+                 const std::string &prefix = "", double weight = 1.0);
+
+  //----------------------------------------------------------------------
+  /** \brief Has the listener serve this connection's requests ahead of
+   * those of connections that are not urgent.  Call after Connect.
+   *
+   * For a second connection carrying small, latency-critical requests
+   * while another carries bulk data, see ThreadedClient::Lane.  Bulk frames
+   * are sent in chunks of TransportOptions::chunk_bytes, so an urgent
+   * request waits for at most one chunk.  Over a comm channel the kernel
+   * serves requests in arrival order, so urgency has no effect beyond that.
+   */
+  void SetUrgent (bool urgent);
+
   //----------------------------------------------------------------------
   /** \brief Runs code in the iPython kernel.
    *
@@ -226,6 +442,69 @@ public:
    */
   void RunCode (const std::string &code);
 
+  //----------------------------------------------------------------------
+  /** \brief Turns profiling of RunCode on or off.  See
+   * ShellConnection::SetProfiling.
+   *
+   * \param enabled  whether to profile.
+   * \param top_functions  how many functions to report from cProfile, or
+   *                       0 not to run the profiler.
+   * \param trace_memory  whether to trace peak memory.
+   */
+  void SetProfiling (bool enabled, size_t top_functions = 0,
+                     bool trace_memory = false);
+
+  //----------------------------------------------------------------------
+  /** \brief Returns the profile of the last RunCode made while profiling.
+   */
+  const ExecutionProfile& LastProfile (void) const;
+
+  //----------------------------------------------------------------------
+  /** \brief Registers code that will be run repeatedly, so that later runs
+   * only send a short call instead of the whole source.
+   *
+   * The code is compiled once in the kernel.  Each Invoke binds its
+   * arguments to the parameter names as globals and runs the compiled code
+   * in the global namespace, just as RunCode would.
+   *
+   * Usage:
+\code
+    PreparedCode update = mpl.Prepare(LoadFile("update_plot.py"),
+                                      {"frame", "data"});
+    for (int frame = 0; ; ++frame) {
+      mpl.SendData(data);
+      mpl.Invoke(update, frame, VariableName{"Data"});
+    }
+\endcode
+   *
+   * \param code  the code as a single string, as for RunCode.
+   * \param parameters  names that Invoke arguments are assigned to.
+   *
+   * \returns the handle to pass to Invoke.
+   */
+  PreparedCode Prepare (const std::string &code,
+                        const std::vector<std::string> &parameters = {});
+
+  //----------------------------------------------------------------------
+  /** \brief Runs code registered with Prepare.
+   *
+   * \param code  the handle returned by Prepare.
+   * \param args  one argument per parameter: numbers, bools, strings or
+   *              VariableName to pass an existing kernel variable.
+   *
+   * \throws std::runtime_error  if the kernel raises, e.g. because it was
+   *                             restarted and no longer has the code.
+   */
+  template <typename... Args>
+  void Invoke (const PreparedCode &code, const Args&... args) {
+    const std::vector<std::string> literals{PythonLiteral(args)...};
+    std::string call = "cpp_ipython_invoke('" + code.Key() + "'";
+    for (const std::string &literal : literals) {
+      call += ", " + literal;
+    }
+    RunCode(call + ")");
+  }
+
   //----------------------------------------------------------------------
   /** \brief Sends a Numpy compatible array to the iPython kernel's global
    * namespace.
@@ -235,10 +514,201 @@ public:
    */
   bool SendData (const NumpyArray &data);
 
+  //----------------------------------------------------------------------
+  /** \brief Brings a DeltaArray up to date in the iPython kernel, only
+   * transmitting the blocks that differ from the last version sent.
+   *
+   * The kernel patches the array in place.  If it no longer has the array,
+   * e.g. because the variable was reassigned, the whole array is resent.
+   *
+   * \param array  the array the data belongs to.
+   * \param data  the values, in the shape given to the array.
+   */
+  bool UpdateData (DeltaArray *array, const double *data);
+
+  //----------------------------------------------------------------------
+  /** \brief Brings a DeltaArray up to date in the iPython kernel, only
+   * transmitting the ranges the caller says changed.
+   *
+   * \param array  the array the data belongs to.
+   * \param data  the values, in the shape given to the array.
+   * \param dirty  the ranges of data changed since the last update.
+   */
+  bool UpdateData (DeltaArray *array, const double *data,
+                   const std::vector<DeltaArray::Range> &dirty);
+
+  //----------------------------------------------------------------------
+  /** \brief Sends a NumpyArray that has already been serialized with
+   * NumpyArray::SerializeTo, as SessionReplayer and
+   * ThreadedClient::SendLatest do.
+   *
+   * \param buffer  the serialized array.
+   * \param size  the number of bytes in buffer.
+   */
+  bool SendSerialized (const void *buffer, size_t size);
+
+  //----------------------------------------------------------------------
+  /** \brief Turns on deduplication of later SendData calls.  Call after
+   * Connect.
+   *
+   * Each array is hashed, and the kernel keeps the arrays it receives in a
+   * cache keyed by the hash.  Sending an array the kernel already holds only
+   * sends its hash and the name to bind it to, and every name bound to the
+   * same contents shares one buffer.  For that reason arrays sent this way
+   * are read-only in the kernel; assign a copy to modify one.
+   *
+   * \param cache_bytes  how much the kernel may keep in its cache, least
+   *                     recently used arrays are evicted first.  0 turns
+   *                     deduplication off.
+   */
+  void SetDeduplication (size_t cache_bytes);
+
+  //----------------------------------------------------------------------
+  /** \brief Records every later SendData and RunCode to a session log.
+   *
+   * \param recorder  the log to append to, or nullptr to stop recording.
+   *                  It must outlive its use here.
+   */
+  void SetRecorder (SessionRecorder *recorder);
+
+  //----------------------------------------------------------------------
+  /** \brief Sends an AffineAxis to the iPython kernel's global namespace,
+   * as its start, step and count only.
+   */
+  bool SendAxis (const AffineAxis &axis);
+
+  //----------------------------------------------------------------------
+  /** \brief Sends a 1D array to the iPython kernel's global namespace, as an
+   * AffineAxis if DetectAffine finds it is one, otherwise in full.
+   *
+   * \param name  the name the array will have in the ipython session.
+   * \param data  the values, e.g. timestamps.
+   * \param count  the number of values.
+   * \param tolerance  how far values may be from evenly spaced, in absolute
+   *                   terms, for the axis to be sent instead.
+   * \param as_affine  if not null, set to whether the values were sent as
+   *                   an AffineAxis.
+   *
+   * \returns true, as for SendData.
+   */
+  bool SendAxis (const std::string &name, const double *data, size_t count,
+                 double tolerance, bool *as_affine = nullptr);
+
+  //----------------------------------------------------------------------
+  /** \brief Sends a QuantizedArray to the iPython kernel's global namespace,
+   * where it is dequantized into a float64 array.
+   *
+   * \param data the data to send.  Only the codes and the offset and scale
+   * of each chunk are transmitted.
+   */
+  bool SendQuantized (const QuantizedArray &data);
+
+  //----------------------------------------------------------------------
+  /** \brief Sends a Table to the iPython kernel's global namespace, where it
+   * becomes a pandas.DataFrame.
+   *
+   * \param table the table to send.  All columns travel in one message.
+   */
+  bool SendTable (const Table &table);
+
+  //----------------------------------------------------------------------
+  /** \brief Sends a sparse matrix to the iPython kernel's global namespace,
+   * where it becomes the matching scipy.sparse matrix type.
+   *
+   * \param matrix the matrix to send.  Only its index and value arrays are
+   * transmitted.
+   */
+  bool SendSparse (const SparseMatrix &matrix);
+
+  //----------------------------------------------------------------------
+  /** \brief Sends an aggregated DensityGrid to the iPython kernel's global
+   * namespace as a height x width array.
+   *
+   * Run cpp_ipython_show_density('name') in the kernel to display it with
+   * imshow over its data extent.
+   *
+   * \param grid the grid to send.
+   */
+  bool SendDensity (const DensityGrid &grid);
+
+  //----------------------------------------------------------------------
+  /** \brief Makes a SeriesPyramid available in the iPython kernel's global
+   * namespace, as a RemoteSeries that fetches from the pyramid on demand.
+   *
+   * Run cpp_ipython_show_pyramid('name') in the kernel to plot the series;
+   * panning or zooming then fetches just the window in view, at about the
+   * plot's pixel width.  Send again after Extend to show the new samples.
+   *
+   * \param pyramid  the series.
+   * \param server  serves the pyramid to the kernel from now on.
+   */
+  bool SendPyramid (const SeriesPyramid *pyramid, ZoomServer *server);
+
+  //----------------------------------------------------------------------
+  /** \brief Sends the next frame of an ImageStream, only transmitting the
+   * tiles that differ from the previous frame.
+   *
+   * If the kernel has lost the stream's buffer, the whole frame is resent.
+   * Run cpp_ipython_show_stream('name') in the kernel to display the stream
+   * with imshow; the image is then updated in place on every frame.
+   *
+   * \param stream  the stream the frame belongs to.
+   * \param pixels  the frame, in the layout given to the stream.
+   */
+  bool SendFrame (ImageStream *stream, const void *pixels);
+
+  //----------------------------------------------------------------------
+  /** \brief Fetches a numpy compatible variable from the iPython kernel's
+   * global namespace.
+   *
+   * The raw buffer comes back over the binary data channel, so values are
+   * exact and there is no text formatting or parsing.
+   *
+   * \param name  the name of the variable.  Anything numpy.asarray accepts
+   *              with a float, int, uint or bool dtype can be fetched.
+   *
+   * \throws std::runtime_error  if the variable does not exist or has an
+   *                             unsupported dtype.
+   */
+  FetchedArray FetchData (const std::string &name);
+
+  //----------------------------------------------------------------------
+  /** \brief Renders a figure in the iPython kernel to an image in memory,
+   * e.g. for the frames of a video.
+   *
+   * The figure is drawn with Agg, as by savefig, whatever the kernel's
+   * backend, and the image comes back over the binary data channel without
+   * touching the filesystem.
+   *
+   * \param figure  the name of a variable holding the figure, its figure
+   *                number, or "" for the current figure.
+   * \param format  "rgba" for raw pixels, returned as a height x width x 4
+   *                array of uint8.  Otherwise any format savefig can write
+   *                to, such as "png" or "jpeg", returned as the bytes of the
+   *                file.
+   * \param dpi  the resolution to render at, 0 for the figure's own.
+   *
+   * \throws std::runtime_error  if there is no such figure or it cannot be
+   *                             rendered in that format.
+   */
+  FetchedArray RenderFigure (const std::string &figure = "",
+                             const std::string &format = "rgba",
+                             double dpi = 0);
+
 private:
+  friend class Broker;
+
+  explicit CppMatplotlib (const TransportOptions &options);
+  std::string DataEndpoint_ (void);
+  bool SendDelta_ (DeltaArray *array, const double *data,
+                   const std::vector<DeltaArray::Range> *dirty);
+
+  TransportOptions options_;
   std::unique_ptr<IPyKernelConfig> upConfig_;
-  std::unique_ptr<RequestSink> upData_conn_;
+  std::unique_ptr<DataChannel> upData_conn_;
   std::unique_ptr<IPythonSession> upSession_;
+  SessionRecorder *recorder_;
+  std::unique_ptr<ContentCache> upCache_;
 };
 
 } // namespace
@@ -4,12 +4,22 @@
 // full text in LICENSE file in root folder of this project.
 //
 
+#include <sys/time.h>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+
+#include <cstdlib>
 #include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
 #include <sstream>
 
 #include <jsoncpp/json/json.h>
 
 #include "ipython_protocol.hpp"
+#include "RequestSink.hpp"
 
 namespace cppmpl {
 
@@ -17,6 +27,73 @@ namespace cppmpl {
 /// identities from message data.
 static const std::string DELIM{"<IDS|MSG>"};
 
+/// Kernel variable holding the result of the last profiled run
+static const std::string PROFILE_VAR_NAME{"cpp_ipython_profile"};
+
+/// Defines the wrapper that profiled runs go through.  It stores the
+/// profile as hex encoded JSON, so its repr needs no unescaping.  Note that
+/// pylab shadows the min, max and sum builtins.
+static const char *PROFILE_CODE = R"CODE(
+def cpp_ipython_profiled(code, top, trace_memory):
+  import binascii, json, sys, time
+  tracemalloc = None
+  if trace_memory:
+    try:
+      import tracemalloc
+    except ImportError:
+      pass
+  now = getattr(time, "perf_counter", time.time)
+  cpu = getattr(time, "process_time", None) or time.clock
+
+  result = {}
+  started_tracing = tracemalloc is not None and not tracemalloc.is_tracing()
+  if started_tracing:
+    tracemalloc.start()
+  if tracemalloc is not None:
+    if hasattr(tracemalloc, "reset_peak"):
+      tracemalloc.reset_peak()
+    base = tracemalloc.get_traced_memory()[0]
+  profiler = None
+  if top > 0:
+    import cProfile
+    profiler = cProfile.Profile()
+
+  try:
+    compiled = compile(code, "<cell>", "exec")
+    wall_start, cpu_start = now(), cpu()
+    if profiler is not None:
+      profiler.enable()
+    try:
+      exec(compiled, globals())
+    finally:
+      if profiler is not None:
+        profiler.disable()
+    result["wall"] = now() - wall_start
+    result["cpu"] = cpu() - cpu_start
+
+    draw_start = now()
+    if "matplotlib.pyplot" in sys.modules:
+      from matplotlib._pylab_helpers import Gcf
+      for manager in Gcf.get_all_fig_managers():
+        if getattr(manager.canvas.figure, "stale", True):
+          manager.canvas.draw()
+    result["draw"] = now() - draw_start
+  finally:
+    if tracemalloc is not None:
+      result["memory"] = tracemalloc.get_traced_memory()[1] - base
+      if started_tracing:
+        tracemalloc.stop()
+
+  if profiler is not None:
+    import pstats
+    stats = sorted(pstats.Stats(profiler).stats.items(),
+                   key=lambda item: -item[1][3])
+    result["top"] = [["%s:%d(%s)" % key, value[1], value[2], value[3]]
+                     for key, value in stats[:top]]
+  globals()["cpp_ipython_profile"] = binascii.hexlify(
+      json.dumps(result).encode("utf-8")).decode("ascii")
+)CODE";
+
 std::string GetUuid (void) {
   uuid_t uuid;
   char uuid_str[37] = {'\0'};
@@ -26,9 +103,74 @@ std::string GetUuid (void) {
 }
 
 
+const std::string& GetUsername (void) {
+  static const std::string username = [] {
+    char buffer[80] = {'\0'};
+    if (getlogin_r(buffer, sizeof(buffer)) != 0) {
+      return std::string{"unknown"};
+    }
+    return std::string{buffer};
+  }();
+  return username;
+}
+
+
+void AppendJsonString (const std::string &str, std::string *out) {
+  static const char HEX[] = "0123456789abcdef";
+
+  out->reserve(out->size() + str.size() + 2);
+  out->push_back('"');
+
+  // Copy runs of characters that need no escaping in one go.
+  const char *run = str.data();
+  const char *end = str.data() + str.size();
+  for (const char *c = run; c != end; ++c) {
+    const unsigned char ch = static_cast<unsigned char>(*c);
+    if (ch >= 0x20 && ch != '"' && ch != '\\') {
+      continue;
+    }
+    out->append(run, c - run);
+    run = c + 1;
+    switch (ch) {
+    case '"':  out->append("\\\""); break;
+    case '\\': out->append("\\\\"); break;
+    case '\n': out->append("\\n");  break;
+    case '\r': out->append("\\r");  break;
+    case '\t': out->append("\\t");  break;
+    case '\b': out->append("\\b");  break;
+    case '\f': out->append("\\f");  break;
+    default:
+      out->append("\\u00");
+      out->push_back(HEX[ch >> 4]);
+      out->push_back(HEX[ch & 0xf]);
+      break;
+    }
+  }
+  out->append(run, end - run);
+  out->push_back('"');
+}
+
+
+// Appends the current UTC time in ISO 8601 format with microseconds, as
+// IPython puts in message headers.
+static void AppendIsoDate (std::string *out) {
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  struct tm utc;
+  gmtime_r(&now.tv_sec, &utc);
+  char buffer[32];
+  size_t len = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+  len += snprintf(buffer + len, sizeof(buffer) - len, ".%06ld",
+                  static_cast<long>(now.tv_usec));
+  out->append(buffer, len);
+}
+
+
 std::string BuildUri (const IPyKernelConfig &config, PortType port) {
   std::stringstream uri;
-  uri << config.transport << "://" << config.ip << ":";
+  // Jupyter names ipc endpoints by appending the port to the path
+  uri << config.transport << "://" << config.ip
+      << (config.transport == "ipc" ? "-" : ":");
   switch (port) {
   case PortType::SHELL: uri << config.shell_port; break;
   case PortType::IOPUB: uri << config.iopub_port; break;
@@ -77,15 +219,518 @@ IPythonMessage::IPythonMessage(const std::vector<Json::Value> &message_parts) :
 IPythonMessage::IPythonMessage(const std::string &ident) :
     IPythonMessage{std::vector<Json::Value>(4, Json::objectValue)}
 {
-  char username[80];
-  getlogin_r(username, 80);
-  header["username"] = std::string(username);
+  header["username"] = GetUsername();
   header["session"] = ident;
   header["msg_id"] = GetUuid();
 }
 
 
 //======================================================================
+void ExecuteReply::Clear (void) {
+  status.clear();
+  traceback.clear();
+  has_variables = false;
+  variables.clear();
+}
+
+
+namespace {
+
+//======================================================================
+// Minimal pull parser over a JSON buffer.  It can read strings and skip any
+// value, which is all ParseExecuteReply needs to pick out a few fields.
+class JsonScanner {
+public:
+  JsonScanner (const char *data, size_t size)
+      : cur_{data}, end_{data + size} {}
+
+  // Consumes c (after whitespace) if it is next.
+  bool Accept (char c) {
+    SkipSpace_();
+    if (cur_ != end_ && *cur_ == c) {
+      ++cur_;
+      return true;
+    }
+    return false;
+  }
+
+  bool Expect (char c) {
+    return Accept(c);
+  }
+
+  bool PeekIs (char c) {
+    SkipSpace_();
+    return cur_ != end_ && *cur_ == c;
+  }
+
+  // Reads a string literal into out, decoding escapes.
+  bool ReadString (std::string *out) {
+    if (!Accept('"')) {
+      return false;
+    }
+    out->clear();
+    const char *run = cur_;
+    while (cur_ != end_) {
+      const char c = *cur_;
+      if (c == '"') {
+        out->append(run, cur_ - run);
+        ++cur_;
+        return true;
+      }
+      if (c != '\\') {
+        ++cur_;
+        continue;
+      }
+      out->append(run, cur_ - run);
+      if (++cur_ == end_) {
+        return false;
+      }
+      switch (*cur_++) {
+      case '"':  out->push_back('"');  break;
+      case '\\': out->push_back('\\'); break;
+      case '/':  out->push_back('/');  break;
+      case 'b':  out->push_back('\b'); break;
+      case 'f':  out->push_back('\f'); break;
+      case 'n':  out->push_back('\n'); break;
+      case 'r':  out->push_back('\r'); break;
+      case 't':  out->push_back('\t'); break;
+      case 'u':
+        if (!ReadUnicodeEscape_(out)) {
+          return false;
+        }
+        break;
+      default:
+        return false;
+      }
+      run = cur_;
+    }
+    return false;
+  }
+
+  // Reads a number, true, false or null as written.
+  bool ReadScalar (std::string *out) {
+    SkipSpace_();
+    const char *start = cur_;
+    while (cur_ != end_ && *cur_ != ',' && *cur_ != '}' && *cur_ != ']'
+           && !IsSpace_(*cur_)) {
+      ++cur_;
+    }
+    out->assign(start, cur_ - start);
+    return !out->empty();
+  }
+
+  // Reads an array of strings, e.g. a traceback.  Non-string elements are
+  // skipped.
+  bool ReadStringArray (std::vector<std::string> *out) {
+    out->clear();
+    if (!Accept('[')) {
+      return SkipValue();
+    }
+    if (Accept(']')) {
+      return true;
+    }
+    do {
+      if (PeekIs('"')) {
+        out->emplace_back();
+        if (!ReadString(&out->back())) {
+          return false;
+        }
+      } else if (!SkipValue()) {
+        return false;
+      }
+    } while (Accept(','));
+    return Expect(']');
+  }
+
+  // Skips over one complete value of any type.
+  bool SkipValue (void) {
+    SkipSpace_();
+    if (cur_ == end_) {
+      return false;
+    }
+    switch (*cur_) {
+    case '"':
+      return SkipString_();
+    case '{':
+    case '[': {
+      // Strings are the only place brackets can hide, so a depth count is
+      // enough to find the matching close.
+      size_t depth = 0;
+      while (cur_ != end_) {
+        const char c = *cur_;
+        if (c == '"') {
+          if (!SkipString_()) {
+            return false;
+          }
+          continue;
+        }
+        ++cur_;
+        if (c == '{' || c == '[') {
+          ++depth;
+        } else if ((c == '}' || c == ']') && --depth == 0) {
+          return true;
+        }
+      }
+      return false;
+    }
+    default:
+      // Number, true, false, null
+      while (cur_ != end_ && *cur_ != ',' && *cur_ != '}' && *cur_ != ']'
+             && !IsSpace_(*cur_)) {
+        ++cur_;
+      }
+      return true;
+    }
+  }
+
+private:
+  static bool IsSpace_ (char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+  }
+
+  void SkipSpace_ (void) {
+    while (cur_ != end_ && IsSpace_(*cur_)) {
+      ++cur_;
+    }
+  }
+
+  bool SkipString_ (void) {
+    ++cur_;  // opening quote
+    while (cur_ != end_) {
+      const char c = *cur_++;
+      if (c == '"') {
+        return true;
+      }
+      if (c == '\\' && cur_ != end_) {
+        ++cur_;
+      }
+    }
+    return false;
+  }
+
+  bool ReadHex4_ (uint32_t *value) {
+    if (end_ - cur_ < 4) {
+      return false;
+    }
+    *value = 0;
+    for (int i = 0; i != 4; ++i) {
+      const char c = *cur_++;
+      *value <<= 4;
+      if (c >= '0' && c <= '9')      *value |= c - '0';
+      else if (c >= 'a' && c <= 'f') *value |= c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F') *value |= c - 'A' + 10;
+      else return false;
+    }
+    return true;
+  }
+
+  bool ReadUnicodeEscape_ (std::string *out) {
+    uint32_t code;
+    if (!ReadHex4_(&code)) {
+      return false;
+    }
+    // Surrogate pair
+    if (code >= 0xd800 && code < 0xdc00 && end_ - cur_ >= 6
+        && cur_[0] == '\\' && cur_[1] == 'u') {
+      cur_ += 2;
+      uint32_t low;
+      if (!ReadHex4_(&low)) {
+        return false;
+      }
+      code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+    }
+
+    // Encode as UTF-8
+    if (code < 0x80) {
+      out->push_back(static_cast<char>(code));
+    } else if (code < 0x800) {
+      out->push_back(static_cast<char>(0xc0 | (code >> 6)));
+      out->push_back(static_cast<char>(0x80 | (code & 0x3f)));
+    } else if (code < 0x10000) {
+      out->push_back(static_cast<char>(0xe0 | (code >> 12)));
+      out->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+      out->push_back(static_cast<char>(0x80 | (code & 0x3f)));
+    } else {
+      out->push_back(static_cast<char>(0xf0 | (code >> 18)));
+      out->push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3f)));
+      out->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+      out->push_back(static_cast<char>(0x80 | (code & 0x3f)));
+    }
+    return true;
+  }
+
+  const char *cur_;
+  const char *end_;
+};
+
+// Parses {"data": {"text/plain": ...}, "status": ..., "traceback": [...]}
+bool ParseVariable (JsonScanner *json, ExecuteReply::Variable *variable) {
+  std::string key;
+  if (!json->Expect('{')) {
+    return false;
+  }
+  if (json->Accept('}')) {
+    return true;
+  }
+  do {
+    if (!json->ReadString(&key) || !json->Expect(':')) {
+      return false;
+    }
+    bool ok = true;
+    if (key == "status") {
+      ok = json->ReadString(&variable->status);
+    } else if (key == "traceback") {
+      ok = json->ReadStringArray(&variable->traceback);
+    } else if (key == "data" && json->Accept('{')) {
+      if (json->Accept('}')) {
+        continue;
+      }
+      do {
+        if (!json->ReadString(&key) || !json->Expect(':')) {
+          return false;
+        }
+        ok = key == "text/plain" ? json->ReadString(&variable->text)
+                                 : json->SkipValue();
+      } while (ok && json->Accept(','));
+      ok = ok && json->Expect('}');
+    } else {
+      ok = json->SkipValue();
+    }
+    if (!ok) {
+      return false;
+    }
+  } while (json->Accept(','));
+  return json->Expect('}');
+}
+
+// Parses {"name": {variable}, ...}
+bool ParseVariables (JsonScanner *json, ExecuteReply *reply) {
+  std::string name;
+  reply->has_variables = true;
+  if (!json->Expect('{')) {
+    return false;
+  }
+  if (json->Accept('}')) {
+    return true;
+  }
+  do {
+    if (!json->ReadString(&name) || !json->Expect(':')
+        || !ParseVariable(json, &reply->variables[name])) {
+      return false;
+    }
+  } while (json->Accept(','));
+  return json->Expect('}');
+}
+
+// Reads the value at path, e.g. {"data", "status"}, in a serialized JSON
+// object.  Scalars come back as written, and an array gives its first
+// element.
+bool ReadJsonPath (const char *data, size_t size,
+                   std::initializer_list<const char*> path,
+                   std::string *value) {
+  JsonScanner json{data, size};
+  std::string key;
+  for (const char *name : path) {
+    if (!json.Expect('{')) {
+      return false;
+    }
+    bool found = false;
+    if (!json.Accept('}')) {
+      do {
+        if (!json.ReadString(&key) || !json.Expect(':')) {
+          return false;
+        }
+        if (key == name) {
+          found = true;
+          break;
+        }
+        if (!json.SkipValue()) {
+          return false;
+        }
+      } while (json.Accept(','));
+    }
+    if (!found) {
+      return false;
+    }
+  }
+  json.Accept('[');
+  return json.PeekIs('"') ? json.ReadString(value) : json.ReadScalar(value);
+}
+
+bool ReadJsonPath (const zmq::message_t &frame,
+                   std::initializer_list<const char*> path,
+                   std::string *value) {
+  return ReadJsonPath(static_cast<const char*>(frame.data()), frame.size(),
+                      path, value);
+}
+
+} // namespace
+
+
+bool ParseExecuteReply (const char *data, size_t size, ExecuteReply *reply) {
+  reply->Clear();
+  JsonScanner json{data, size};
+  std::string key;
+
+  if (!json.Expect('{')) {
+    return false;
+  }
+  if (json.Accept('}')) {
+    return true;
+  }
+  do {
+    if (!json.ReadString(&key) || !json.Expect(':')) {
+      return false;
+    }
+    bool ok;
+    if (key == "status") {
+      ok = json.ReadString(&reply->status);
+    } else if (key == "traceback") {
+      ok = json.ReadStringArray(&reply->traceback);
+    } else if (key == "user_variables" || key == "user_expressions") {
+      ok = ParseVariables(&json, reply);
+    } else {
+      ok = json.SkipValue();
+    }
+    if (!ok) {
+      return false;
+    }
+  } while (json.Accept(','));
+  return json.Expect('}');
+}
+
+
+//======================================================================
+MessageBuilder::MessageBuilder (const std::string &ident) :
+    ident_(ident),
+    protocol_version_{4},
+    msg_count_{0}
+{
+  SetProtocolVersion(protocol_version_);
+}
+
+void MessageBuilder::SetProtocolVersion (int major) {
+  protocol_version_ = major;
+  execute_header_tail_ = RenderHeaderTail_("execute_request");
+  comm_msg_header_tail_ = RenderHeaderTail_("comm_msg");
+}
+
+std::string MessageBuilder::LastMsgId (void) const {
+  return ident_ + "-" + std::to_string(msg_count_);
+}
+
+std::string MessageBuilder::RenderHeaderTail_ (
+    const std::string &msg_type) const {
+  // Keys are in the order Json::FastWriter would produce.  The date and
+  // msg_id come first and are filled in per message by RenderHeader_.
+  std::string tail{"\",\"msg_type\":"};
+  AppendJsonString(msg_type, &tail);
+  tail.append(",\"session\":");
+  AppendJsonString(ident_, &tail);
+  tail.append(",\"username\":");
+  AppendJsonString(GetUsername(), &tail);
+  if (protocol_version_ >= 5) {
+    tail.append(",\"version\":\"5.3\"");
+  }
+  tail.push_back('}');
+  return tail;
+}
+
+void MessageBuilder::RenderHeader_ (const std::string &header_tail,
+                                    std::string *out) {
+  // The msg_id only needs to be unique, so a per-session counter stands in
+  // for a fresh uuid.  Session ids are uuids and never contain quotes.
+  out->assign("{\"date\":\"");
+  AppendIsoDate(out);
+  out->append("\",\"msg_id\":\"");
+  out->append(ident_);
+  out->push_back('-');
+  out->append(std::to_string(++msg_count_));
+  out->append(header_tail);
+}
+
+void MessageBuilder::RenderExecuteRequest (
+    const std::string &code, const std::vector<std::string> &variable_names,
+    SerializedMessage *message) {
+  RenderHeader_(execute_header_tail_, &message->parts[0]);
+  message->parts[1].assign("{}");
+  message->parts[2].assign("{}");
+
+  std::string &content = message->parts[3];
+  content.assign("{\"allow_stdin\":false,\"code\":");
+  AppendJsonString(code, &content);
+  content.append(",\"silent\":false,\"store_history\":true,");
+
+  // Protocol 5 dropped user_variables, but evaluating each name as an
+  // expression gives the same result.
+  if (protocol_version_ >= 5) {
+    content.append("\"user_expressions\":{");
+    for (size_t i = 0; i != variable_names.size(); ++i) {
+      if (i != 0) {
+        content.push_back(',');
+      }
+      AppendJsonString(variable_names[i], &content);
+      content.push_back(':');
+      AppendJsonString(variable_names[i], &content);
+    }
+    content.append("}}");
+    return;
+  }
+
+  content.append("\"user_expressions\":{},\"user_variables\":[");
+  for (size_t i = 0; i != variable_names.size(); ++i) {
+    if (i != 0) {
+      content.push_back(',');
+    }
+    AppendJsonString(variable_names[i], &content);
+  }
+  content.append("]}");
+}
+
+void MessageBuilder::RenderKernelInfoRequest (SerializedMessage *message) {
+  RenderHeader_(RenderHeaderTail_("kernel_info_request"), &message->parts[0]);
+  message->parts[1].assign("{}");
+  message->parts[2].assign("{}");
+  message->parts[3].assign("{}");
+}
+
+void MessageBuilder::RenderCommContent_ (const std::string &comm_id,
+                                         std::string *out) {
+  out->assign("{\"comm_id\":");
+  AppendJsonString(comm_id, out);
+  out->append(",\"data\":{}");
+}
+
+void MessageBuilder::RenderCommOpen (const std::string &comm_id,
+                                     const std::string &target_name,
+                                     SerializedMessage *message) {
+  RenderHeader_(RenderHeaderTail_("comm_open"), &message->parts[0]);
+  message->parts[1].assign("{}");
+  message->parts[2].assign("{}");
+  RenderCommContent_(comm_id, &message->parts[3]);
+  message->parts[3].append(",\"target_name\":");
+  AppendJsonString(target_name, &message->parts[3]);
+  message->parts[3].push_back('}');
+}
+
+void MessageBuilder::RenderCommMsg (const std::string &comm_id,
+                                    SerializedMessage *message) {
+  RenderHeader_(comm_msg_header_tail_, &message->parts[0]);
+  message->parts[1].assign("{}");
+  message->parts[2].assign("{}");
+  RenderCommContent_(comm_id, &message->parts[3]);
+  message->parts[3].push_back('}');
+}
+
+void MessageBuilder::RenderCommClose (const std::string &comm_id,
+                                      SerializedMessage *message) {
+  RenderHeader_(RenderHeaderTail_("comm_close"), &message->parts[0]);
+  message->parts[1].assign("{}");
+  message->parts[2].assign("{}");
+  RenderCommContent_(comm_id, &message->parts[3]);
+  message->parts[3].push_back('}');
+}
+
 IPythonMessage MessageBuilder::BuildExecuteRequest (
     const std::string &code) const {
   IPythonMessage message{ident_};
@@ -106,22 +751,30 @@ IPythonMessage MessageBuilder::BuildExecuteRequest (
 IPythonHmac::IPythonHmac (const IPyKernelConfig &config) :
     key_(config.key),
     evp_type_fn_(GetEvpTypeFnFromConfig_(config))
-{}
-
-std::string IPythonHmac::operator() (const IPythonMessage &message) const {
+{
   ENGINE_load_builtin_engines();
   ENGINE_register_all_complete();
+}
+
+std::string IPythonHmac::operator() (const IPythonMessage &message) const {
+  SerializedMessage serialized;
+  Json::FastWriter writer;
+  for (size_t i = 0; i != serialized.parts.size(); ++i) {
+    serialized.parts[i] = writer.write(message.message_parts_[i]);
+  }
+  return (*this)(serialized);
+}
+
+std::string IPythonHmac::operator() (const SerializedMessage &message) const {
+  static const char HEX[] = "0123456789abcdef";
 
   HMAC_CTX hmac_ctx;
   HMAC_CTX_init(&hmac_ctx);
   HMAC_Init_ex(&hmac_ctx, key_.data(), key_.size(),
                evp_type_fn_(), nullptr);
 
-  Json::FastWriter writer;
   for (const auto& part : message) {
-    std::string serialized{writer.write(part)};
-    HMAC_Update(&hmac_ctx, (const uint8_t*)(serialized.data()),
-                serialized.size());
+    HMAC_Update(&hmac_ctx, (const uint8_t*)(part.data()), part.size());
   }
 
   unsigned int result_len = 32;
@@ -129,13 +782,13 @@ std::string IPythonHmac::operator() (const IPythonMessage &message) const {
   HMAC_Final(&hmac_ctx, result, &result_len);
   HMAC_CTX_cleanup(&hmac_ctx);
 
-  std::stringstream hmac;
-  for (size_t i = 0; i != 32; ++i) {
-    hmac << std::setfill('0') << std::setw(2) << std::hex
-      << static_cast<int>(result[i]);
+  std::string hmac(2*result_len, '0');
+  for (size_t i = 0; i != result_len; ++i) {
+    hmac[2*i] = HEX[result[i] >> 4];
+    hmac[2*i + 1] = HEX[result[i] & 0xf];
   }
 
-  return hmac.str();
+  return hmac;
 }
 
 const IPythonHmac::EvpTypeFn IPythonHmac::GetEvpTypeFnFromConfig_ (
@@ -155,13 +808,112 @@ const IPythonHmac::EvpTypeFn IPythonHmac::GetEvpTypeFnFromConfig_ (
 //======================================================================
 void ShellConnection::Connect (void) {
   socket_.setsockopt(ZMQ_DEALER, ident_.data(), ident_.size());
+  ConfigureSocket(options_, &socket_);
   socket_.connect(uri_.c_str());
+  message_builder_.SetProtocolVersion(KernelInfo());
+}
+
+int ShellConnection::KernelInfo (void) {
+  message_builder_.RenderKernelInfoRequest(&request_);
+  Send_(request_);
+  ReceiveContent_();
+
+  // "5.3" from protocol 5 on, [4, 1] from IPython 1.x
+  std::string version;
+  protocol_version_ = 4;
+  if (ReadJsonPath(content_, {"protocol_version"}, &version)) {
+    protocol_version_ = std::atoi(version.c_str());
+  }
+  return protocol_version_;
+}
+
+void ShellConnection::OpenComm (const std::string &comm_id,
+                                const std::string &target_name) {
+  message_builder_.RenderCommOpen(comm_id, target_name, &request_);
+  Send_(request_);
+}
+
+std::string ShellConnection::SendComm (const std::string &comm_id,
+                                       const std::vector<Frame> &buffers) {
+  message_builder_.RenderCommMsg(comm_id, &request_);
+  Send_(request_, buffers);
+  return message_builder_.LastMsgId();
+}
+
+void ShellConnection::CloseComm (const std::string &comm_id) {
+  message_builder_.RenderCommClose(comm_id, &request_);
+  Send_(request_);
 }
 
 void ShellConnection::RunCode (const std::string &code) {
+  if (profiling_) {
+    RunProfiled_(code);
+    return;
+  }
   GenericRun_(code, {});
 }
 
+void ShellConnection::SetProfiling (bool enabled, size_t top_functions,
+                                    bool trace_memory) {
+  profiling_ = enabled;
+  profile_functions_ = top_functions;
+  profile_memory_ = trace_memory;
+}
+
+void ShellConnection::RunProfiled_ (const std::string &code) {
+  // Defined once per connection, so later runs only send the call and the
+  // round trip measures little beyond the code itself
+  if (!profile_defined_) {
+    GenericRun_(PROFILE_CODE, {});
+    profile_defined_ = true;
+  }
+
+  // A JSON string literal is also a valid python one
+  std::string wrapped{"cpp_ipython_profiled("};
+  AppendJsonString(code, &wrapped);
+  wrapped.append(", " + std::to_string(profile_functions_));
+  wrapped.append(profile_memory_ ? ", True)\n" : ", False)\n");
+
+  const auto start = std::chrono::steady_clock::now();
+  const ExecuteReply &reply = GenericRun_(wrapped, {PROFILE_VAR_NAME});
+  profile_ = ExecutionProfile{};
+  profile_.round_trip_seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+
+  auto variable = reply.variables.find(PROFILE_VAR_NAME);
+  if (variable == reply.variables.end() || variable->second.status != "ok") {
+    throw std::runtime_error("Profile missing from execute_reply");
+  }
+
+  // The repr is the hex digits in quotes, perhaps with a u prefix
+  const std::string &text = variable->second.text;
+  const size_t first = text.find('\'');
+  const size_t last = text.rfind('\'');
+  std::string json;
+  for (size_t i = first + 1; first != std::string::npos && i + 1 < last;
+       i += 2) {
+    json.push_back(static_cast<char>(
+        std::stoi(text.substr(i, 2), nullptr, 16)));
+  }
+
+  Json::Value result;
+  Json::Reader reader;
+  if (!reader.parse(json, result)) {
+    throw std::runtime_error("Malformed profile");
+  }
+  profile_.wall_seconds = result["wall"].asDouble();
+  profile_.cpu_seconds = result["cpu"].asDouble();
+  profile_.draw_seconds = result["draw"].asDouble();
+  if (result.isMember("memory")) {
+    profile_.peak_memory_bytes = result["memory"].asInt64();
+  }
+  for (const Json::Value &row : result["top"]) {
+    profile_.functions.push_back(ExecutionProfile::Function{
+        row[0].asString(), row[1].asUInt64(), row[2].asDouble(),
+        row[3].asDouble()});
+  }
+}
+
 bool ShellConnection::HasVariable (const std::string &variable_name) {
   // The response looks like
   // {
@@ -176,125 +928,217 @@ bool ShellConnection::HasVariable (const std::string &variable_name) {
   // 		"status" : "ok"
   // 	}
   // }
-  IPythonMessage response = GenericRun_("None", {variable_name});
-  return response.content["user_variables"][variable_name]["status"]
-    .asString() == "ok";
+  const ExecuteReply &reply = GenericRun_("None", {variable_name});
+  auto variable = reply.variables.find(variable_name);
+  return variable != reply.variables.end() && variable->second.status == "ok";
 }
 
 std::string ShellConnection::GetVariable (const std::string &variable_name) {
-  IPythonMessage response = GenericRun_("None", {variable_name});
-  Json::Value variable_dict;
-  if (response.content.isMember("user_variables")) {
-    variable_dict = response.content["user_variables"][variable_name];
-  } else if (response.content.isMember("user_expressions")) {
-    variable_dict = response.content["user_expressions"][variable_name];
-  } else {
-    std::cout << response.content << std::endl;
+  const ExecuteReply &reply = GenericRun_("None", {variable_name});
+  auto variable = reply.variables.find(variable_name);
+  if (!reply.has_variables || variable == reply.variables.end()) {
     throw std::runtime_error("Returned JSON not understood");
   }
 
   // Check that the variable exists
-  if (variable_dict["status"] == "error") {
-    for (const auto &json : variable_dict["traceback"]) {
-      std::cerr << json.asString() << std::endl;
+  if (variable->second.status == "error") {
+    for (const auto &line : variable->second.traceback) {
+      std::cerr << line << std::endl;
     }
     throw std::runtime_error("Error with looking up variable");
   }
 
-  return variable_dict["data"]["text/plain"].asString();
+  return variable->second.text;
 }
 
 // This is a helper for the specific methods that execute code or look for
 // variables.
-IPythonMessage ShellConnection::GenericRun_ (
+const ExecuteReply& ShellConnection::GenericRun_ (
     const std::string &code, const std::vector<std::string> &variable_names) {
-  IPythonMessage command = message_builder_.BuildExecuteRequest(code);
-  for (const std::string &variable : variable_names) {
-    command.content["user_variables"].append(variable);
-  }
-  IPythonMessage response = Send_(command);
+  message_builder_.RenderExecuteRequest(code, variable_names, &request_);
+  Send_(request_);
+  ReceiveReply_(&reply_);
 
   // Error check code execution
-  if (response.content["status"].asString() == "error") {
-    for (const auto &json : response.content["traceback"]) {
-      std::cerr << json.asString() << std::endl;
+  if (reply_.status == "error") {
+    for (const auto &line : reply_.traceback) {
+      std::cerr << line << std::endl;
     }
     throw std::runtime_error("Error with execute_request");
   }
-  return response;
+  return reply_;
 }
 
-IPythonMessage ShellConnection::Send_ (const IPythonMessage &message) {
+void ShellConnection::Send_ (const SerializedMessage &message,
+                             const std::vector<Frame> &buffers) {
   if (!socket_.connected()) {
-    // TODO throw an exception?
-    return IPythonMessage("None");
+    throw std::runtime_error("Shell socket is not connected");
   }
 
-  // Fill in the byte buffer vector with all the data required for the message
-  // line format.
-  std::vector<std::vector<uint8_t>> parts;
-  parts.push_back(std::vector<uint8_t>(DELIM.begin(), DELIM.end()));
-  std::string hmac = hmac_fn_(message);
-  parts.push_back(std::vector<uint8_t>(hmac.begin(), hmac.end()));
-  Json::FastWriter writer;
-  for (const Json::Value &section : message) {
-    std::string serialized = writer.write(section);
-    parts.push_back(std::vector<uint8_t>(serialized.begin(),
-                                         serialized.end()));
+  // Send the wire format: delimiter, signature, then the four JSON parts
+  // straight out of their buffers.
+  std::string hmac = hmac_(message);
+  socket_.send(DELIM.data(), DELIM.size(), ZMQ_SNDMORE);
+  socket_.send(hmac.data(), hmac.size(), ZMQ_SNDMORE);
+  for (size_t i = 0; i != message.parts.size(); ++i) {
+    const std::string &part = message.parts[i];
+    socket_.send(part.data(), part.size(),
+                 i + 1 != message.parts.size() || !buffers.empty()
+                 ? ZMQ_SNDMORE : 0);
   }
 
-  // Send the message parts
-  for (size_t i = 0; i != parts.size()-1; ++i) {
-    socket_.send(parts[i].data(), parts[i].size(), ZMQ_SNDMORE);
+  // Buffers are not signed.  They are copied, as the wait for the reply
+  // can time out, after which the caller frees them while zmq may still
+  // have them queued.  DataChannel chunking bounds the size of each copy.
+  for (size_t i = 0; i != buffers.size(); ++i) {
+    socket_.send(buffers[i].data, buffers[i].size,
+                 i + 1 != buffers.size() ? ZMQ_SNDMORE : 0);
   }
-  socket_.send(parts.back().data(), parts.back().size());
+}
 
-  // Receive the response
-  // 1) Strip out the leading stuff
-  zmq::message_t response;
+void ShellConnection::ReceiveContent_ (void) {
+  // 1) Strip out the leading identities up to the delimiter
   while (true) {
-    socket_.recv(&response);
-    std::string serialized(reinterpret_cast<char*>(response.data()),
-                           response.size());
-    if (serialized == DELIM || !response.more()) {
+    socket_.recv(&frame_);
+    if ((frame_.size() == DELIM.size()
+         && std::memcmp(frame_.data(), DELIM.data(), DELIM.size()) == 0)
+        || !frame_.more()) {
       break;
     }
   }
 
-  // 2) Get the HMAC signature
+  // 2) Skip the HMAC signature
   // TODO verify contents via HMAC
-  std::string hmac_signature{"NONE"};
-  if (response.more()) {
-    socket_.recv(&response);
-    hmac_signature = std::string(reinterpret_cast<char*>(response.data()),
-                                 response.size());
+  if (frame_.more()) {
+    socket_.recv(&frame_);
   }
 
-  // 3) Get the header, parent, metadata, and content
-  std::vector<Json::Value> response_message_parts;
-  while (response.more()) {
-    socket_.recv(&response);
-    std::string serialized(reinterpret_cast<char*>(response.data()),
-                           response.size());
-    std::stringstream json_stream(serialized);
-    Json::Value root;
-    json_stream >> root;
-    response_message_parts.push_back(root);
+  // 3) Skip the header, parent and metadata and keep only the content.
+  // Anything after that (e.g. buffers) is drained and ignored.
+  content_.rebuild();
+  bool more = frame_.more();
+  for (size_t part = 0; more; ++part) {
+    zmq::message_t *frame = part == 3 ? &content_ : &frame_;
+    socket_.recv(frame);
+    more = frame->more();
   }
+}
 
-  return IPythonMessage{response_message_parts};
+void ShellConnection::ReceiveReply_ (ExecuteReply *reply) {
+  ReceiveContent_();
+  if (!ParseExecuteReply(static_cast<const char*>(content_.data()),
+                         content_.size(), reply)) {
+    reply->Clear();
+    throw std::runtime_error("Malformed execute_reply");
+  }
 }
 
 
 //======================================================================
-IPythonSession::IPythonSession (const IPyKernelConfig &config) :
+void IOPubConnection::Connect (void) {
+  ConfigureSocket(options_, &socket_);
+  socket_.setsockopt(ZMQ_SUBSCRIBE, "", 0);
+  socket_.connect(uri_.c_str());
+}
+
+bool IOPubConnection::Poll (long timeout_ms) {
+  zmq::pollitem_t item{static_cast<void*>(socket_), 0, ZMQ_POLLIN, 0};
+  return zmq::poll(&item, 1, timeout_ms) > 0;
+}
+
+void IOPubConnection::Discard (void) {
+  while (Poll(0)) {
+    ReceiveMessage_();
+  }
+}
+
+bool IOPubConnection::ReceiveMessage_ (void) {
+  // Topic and identities up to the delimiter, then the signature, the four
+  // JSON parts and any buffers
+  zmq::message_t frame;
+  bool delimited = false;
+  do {
+    socket_.recv(&frame);
+    delimited = frame.size() == DELIM.size()
+        && std::memcmp(frame.data(), DELIM.data(), DELIM.size()) == 0;
+  } while (!delimited && frame.more());
+
+  frames_.clear();
+  bool more = delimited && frame.more();
+  while (more) {
+    frames_.emplace_back();
+    socket_.recv(&frames_.back());
+    more = frames_.back().more();
+  }
+  return frames_.size() >= 5;
+}
+
+std::vector<zmq::message_t> IOPubConnection::ReceiveCommReply (
+    const std::string &parent_msg_id) {
+  // Everything published, e.g. other clients' output, goes past here, so
+  // anything not in reply to our message is skipped.
+  const auto deadline = std::chrono::steady_clock::now()
+      + std::chrono::milliseconds(options_.reply_timeout_ms);
+  while (true) {
+    long wait_ms = -1;
+    if (options_.reply_timeout_ms >= 0) {
+      wait_ms = std::max<long>(0, std::chrono::duration_cast<
+          std::chrono::milliseconds>(
+              deadline - std::chrono::steady_clock::now()).count());
+    }
+    if (!Poll(wait_ms)) {
+      throw std::runtime_error("Timed out waiting for a comm reply");
+    }
+    if (!ReceiveMessage_()
+        || !ReadJsonPath(frames_[2], {"msg_id"}, &value_)
+        || value_ != parent_msg_id
+        || !ReadJsonPath(frames_[1], {"msg_type"}, &value_)) {
+      continue;
+    }
+
+    if (value_ == "comm_msg") {
+      if (!ReadJsonPath(frames_[4], {"data", "status"}, &value_)) {
+        throw std::runtime_error("Malformed comm reply");
+      }
+      if (value_ != "Success") {
+        throw std::runtime_error(value_);
+      }
+      return std::vector<zmq::message_t>(
+          std::make_move_iterator(frames_.begin() + 5),
+          std::make_move_iterator(frames_.end()));
+    }
+
+    // The kernel goes idle after handling our message, so a missing reply
+    // shows up as an idle status first.
+    if (value_ == "status"
+        && ReadJsonPath(frames_[4], {"execution_state"}, &value_)
+        && value_ == "idle") {
+      throw std::runtime_error("The kernel did not reply to a comm message");
+    }
+  }
+}
+
+
+//======================================================================
+IPythonSession::IPythonSession (const IPyKernelConfig &config,
+                                const TransportOptions &options) :
     config_{config},
-    zmq_context_{1},
-    shell_connection_{config, zmq_context_}
+    zmq_context_{options.io_threads},
+    shell_connection_{config, zmq_context_, options},
+    iopub_connection_{config, zmq_context_, options},
+    iopub_connected_{false}
 {}
 
 void IPythonSession::Connect (void) {
   shell_connection_.Connect();
 }
 
+IOPubConnection& IPythonSession::IOPub (void) {
+  if (!iopub_connected_) {
+    iopub_connection_.Connect();
+    iopub_connected_ = true;
+  }
+  return iopub_connection_;
+}
+
 } // namespace
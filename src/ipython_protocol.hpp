@@ -13,10 +13,13 @@ extern "C" {
 #include <uuid/uuid.h>
 }
 
+#include <array>
 #include <functional>
 #include <iomanip>
+#include <map>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <jsoncpp/json/json.h>
 #include <openssl/engine.h>
@@ -24,11 +27,16 @@ extern "C" {
 #include <openssl/hmac.h>
 #include <zmq.hpp>
 
+#include "ExecutionProfile.hpp"
+#include "RequestSink.hpp"
+#include "TransportOptions.hpp"
+
 namespace cppmpl {
 
 // forward declarations
 struct IPyKernelConfig;
 struct IPythonMessage;
+struct SerializedMessage;
 
 /// Function object that computes an HMAC hash from an IPythonMessage.
 typedef std::function<std::string(const IPythonMessage &message)> HmacFn;
@@ -43,7 +51,25 @@ std::string GetUuid(void);
 
 
 //--------------------------------------------------
-/** \brief Returns a string URI like "tcp://hostname:port" from its args.
+/** \brief Returns the login name of the current user.  It is looked up once
+ * and cached for the lifetime of the process.
+ */
+const std::string& GetUsername(void);
+
+
+//--------------------------------------------------
+/** \brief Appends a string to a buffer as a quoted JSON string literal,
+ * escaping quotes, backslashes and control characters.
+ *
+ * \param str  the raw string.
+ * \param out  the buffer to append to.
+ */
+void AppendJsonString(const std::string &str, std::string *out);
+
+
+//--------------------------------------------------
+/** \brief Returns a string URI like "tcp://hostname:port" from its args,
+ * or "ipc://path-port" for kernels using Unix domain sockets.
  *
  * \param config  Config containing hostname and transport type.
  * \param port  Port the host is listening on.
@@ -144,6 +170,79 @@ struct IPythonMessage {
 };
 
 
+//======================================================================
+/** \brief The four JSON data parts of a message in their serialized wire
+ * form, i.e. exactly the bytes that are signed and sent.
+ *
+ * Buffers are reused between messages, so holding on to one of these and
+ * re-rendering into it avoids most allocations on the send path.
+ */
+struct SerializedMessage {
+  /// Convenience typedef
+  typedef std::array<std::string, 4> MessageParts;
+
+  /// [header, parent_header, metadata, content]
+  MessageParts parts;
+
+  // Iterator passthroughs so the SerializedMessage class can be iterated over.
+  MessageParts::const_iterator begin() const { return parts.begin(); }
+  MessageParts::const_iterator end() const { return parts.end(); }
+};
+
+
+//======================================================================
+/** \brief The fields of an execute_reply that this library cares about,
+ * extracted by ParseExecuteReply without building a full JSON tree.
+ */
+struct ExecuteReply {
+  /// Result of evaluating one entry of user_variables or user_expressions.
+  struct Variable {
+    /// "ok" or "error"
+    std::string status;
+
+    /// The __str__/__repr__ of the value, from data["text/plain"]
+    std::string text;
+
+    /// Traceback lines if status is "error"
+    std::vector<std::string> traceback;
+  };
+
+  /// "ok", "error" or "abort"
+  std::string status;
+
+  /// Traceback lines if status is "error"
+  std::vector<std::string> traceback;
+
+  /// Whether the reply had a user_variables or user_expressions field
+  bool has_variables;
+
+  /// Merged contents of user_variables and user_expressions
+  std::map<std::string, Variable> variables;
+
+  ExecuteReply (void) : has_variables{false} {}
+
+  //--------------------------------------------------
+  /** \brief Empties all fields, keeping allocated capacity where possible.
+   */
+  void Clear (void);
+};
+
+
+//--------------------------------------------------
+/** \brief Parses the serialized content part of an execute_reply.
+ *
+ * Only status, traceback and user_variables/user_expressions are
+ * materialized, everything else is skipped over in place.
+ *
+ * \param data  pointer to the serialized JSON content.
+ * \param size  number of bytes in data.
+ * \param reply  the reply to fill in.  Cleared first.
+ *
+ * \returns whether data was well formed JSON.
+ */
+bool ParseExecuteReply(const char *data, size_t size, ExecuteReply *reply);
+
+
 //======================================================================
 /** \brief Class of factory methods for constructing various kinds of
  * IPythonMessages associated with a particular session.
@@ -162,7 +261,19 @@ public:
    *
    * \param ident  the identity of the session, any arbitrary string, but .
    */
-  explicit MessageBuilder(const std::string &ident) : ident_(ident) {}
+  explicit MessageBuilder(const std::string &ident);
+
+  //--------------------------------------------------
+  /** \brief Sets the major version of the messaging protocol the kernel
+   * speaks.  From 5 on, headers carry a version and variables are looked up
+   * through user_expressions, as user_variables was removed.
+   */
+  void SetProtocolVersion (int major);
+
+  //--------------------------------------------------
+  /** \brief Returns the msg_id of the last message rendered.
+   */
+  std::string LastMsgId (void) const;
 
   //--------------------------------------------------
   /** \brief Returns a new ExecuteRequest message.
@@ -171,8 +282,58 @@ public:
    */
   IPythonMessage BuildExecuteRequest (const std::string &code) const ;
 
+  //--------------------------------------------------
+  /** \brief Renders an execute_request straight to its wire form.
+   *
+   * The header and content skeletons are rendered once at construction, so
+   * only msg_id, date and the escaped code are spliced in per message.
+   *
+   * \param code  The code to be run in an iPython kernel.
+   * \param variable_names  names to return in user_variables.
+   * \param message  the message to render into.  Overwrites contents.
+   */
+  void RenderExecuteRequest (const std::string &code,
+                             const std::vector<std::string> &variable_names,
+                             SerializedMessage *message);
+
+  //--------------------------------------------------
+  /** \brief Renders a kernel_info_request.
+   */
+  void RenderKernelInfoRequest (SerializedMessage *message);
+
+  //--------------------------------------------------
+  /** \brief Renders a comm_open for a comm target registered in the kernel.
+   */
+  void RenderCommOpen (const std::string &comm_id,
+                       const std::string &target_name,
+                       SerializedMessage *message);
+
+  //--------------------------------------------------
+  /** \brief Renders a comm_msg with empty data, the payload of which is
+   * sent as binary buffers after the message.
+   */
+  void RenderCommMsg (const std::string &comm_id, SerializedMessage *message);
+
+  //--------------------------------------------------
+  /** \brief Renders a comm_close.
+   */
+  void RenderCommClose (const std::string &comm_id,
+                        SerializedMessage *message);
+
 private:
+  std::string RenderHeaderTail_ (const std::string &msg_type) const;
+  void RenderHeader_ (const std::string &header_tail, std::string *out);
+  void RenderCommContent_ (const std::string &comm_id, std::string *out);
+
   const std::string ident_;
+  int protocol_version_;
+
+  // Pre-rendered header fields after msg_id, e.g. ","msg_type":...}
+  std::string execute_header_tail_;
+  std::string comm_msg_header_tail_;
+
+  // Counter appended to ident_ to form unique msg_ids.
+  uint64_t msg_count_;
 };
 
 
@@ -210,6 +371,13 @@ public:
    * \param message  the IPythonMessage whose signature it computes.
    */
   std::string operator() (const IPythonMessage &message) const;
+
+  //--------------------------------------------------
+  /** \brief Returns the HMAC signature for an already serialized message.
+   *
+   * \param message  the SerializedMessage whose signature it computes.
+   */
+  std::string operator() (const SerializedMessage &message) const;
   
 private:
   const EvpTypeFn GetEvpTypeFnFromConfig_(const IPyKernelConfig &config) const;
@@ -236,10 +404,9 @@ private:
     // Set up parameters
     IPyKernelConfig config("path/to/kernel-NNN.json")
     zmq::context_t zmq_context(1);
-    HmacFn hmac_fn{IPythonHmac("secret key", EVP_sha256)};
 
-    // Create the connection.  The host info is in the config.
-    ShellConnection conn{config, zmq_context, hmac_fn};
+    // Create the connection.  The host info and HMAC key are in the config.
+    ShellConnection conn{config, zmq_context};
     conn.Connect();
 
     if (!conn.HasVariable("my_var")) {
@@ -257,20 +424,42 @@ public:
    *
    * \param config  a valid IPyKernelConfig configuration
    * \param context  the ZeroMQ context to use for socket connections
+   * \param options  socket settings for the connection
    */ 
-  ShellConnection (const IPyKernelConfig &config, zmq::context_t &context) :
-      hmac_fn_{IPythonHmac(config)},
+  ShellConnection (const IPyKernelConfig &config, zmq::context_t &context,
+                   const TransportOptions &options = TransportOptions{}) :
+      hmac_{config},
       ident_{GetUuid()},
       message_builder_{ident_},
       socket_(context, ZMQ_DEALER),
-      uri_{BuildUri(config, PortType::SHELL)}
+      uri_{BuildUri(config, PortType::SHELL)},
+      options_{options},
+      protocol_version_{4},
+      profiling_{false},
+      profile_functions_{0},
+      profile_memory_{false},
+      profile_defined_{false}
   {}
 
   //--------------------------------------------------
-  /** \brief Connect to the shell socket on a running IPython kernel.
+  /** \brief Connect to the shell socket on a running IPython kernel, and
+   * find out which version of the messaging protocol it speaks.
    */
   void Connect (void);
 
+  //--------------------------------------------------
+  /** \brief Sends a kernel_info_request and waits for the reply.
+   *
+   * \returns the major version of the kernel's messaging protocol.
+   */
+  int KernelInfo (void);
+
+  //--------------------------------------------------
+  /** \brief Returns the major version of the kernel's messaging protocol,
+   * as found by Connect.
+   */
+  int ProtocolVersion (void) const { return protocol_version_; }
+
   //--------------------------------------------------
   /** \brief Runs code in the associated IPython kernel.
    *
@@ -282,6 +471,29 @@ public:
    */
   void RunCode (const std::string &code);
 
+  //--------------------------------------------------
+  /** \brief Turns profiling of RunCode on or off.
+   *
+   * While on, the code is run inside a wrapper that times it, redraws the
+   * matplotlib figures it changed, and optionally runs it under cProfile
+   * and traces its peak memory.  The results arrive with the
+   * execute_reply, so there is no extra round trip, but the optional
+   * measurements slow the code down, and the times reported with them.
+   *
+   * \param enabled  whether to profile.
+   * \param top_functions  how many functions to report from cProfile, or
+   *                       0 not to run the profiler.
+   * \param trace_memory  whether to trace allocations with tracemalloc for
+   *                      ExecutionProfile::peak_memory_bytes.
+   */
+  void SetProfiling (bool enabled, size_t top_functions = 0,
+                     bool trace_memory = false);
+
+  //--------------------------------------------------
+  /** \brief Returns the profile of the last RunCode made while profiling.
+   */
+  const ExecutionProfile& LastProfile (void) const { return profile_; }
+
   //--------------------------------------------------
   /** \brief Returns whether a variable exists in the global namespace of the
    * associated IPython kernel.
@@ -304,16 +516,116 @@ public:
    */
   std::string GetVariable (const std::string &variable_name);
 
-private:
-  IPythonMessage GenericRun_ (const std::string &code,
-                              const std::vector<std::string> &variable_names);
-  IPythonMessage Send_ (const IPythonMessage &message);
+  //--------------------------------------------------
+  /** \brief Opens a comm to a target registered in the kernel.  Protocol 5
+   * kernels only.
+   */
+  void OpenComm (const std::string &comm_id, const std::string &target_name);
+
+  //--------------------------------------------------
+  /** \brief Sends a comm_msg carrying buffers as binary frames, copied so
+   * the caller may free them as soon as this returns.  Comm messages have
+   * no shell reply; any reply arrives on the IOPub socket.
+   *
+   * \returns the msg_id of the message, which replies give as parent.
+   */
+  std::string SendComm (const std::string &comm_id,
+                        const std::vector<Frame> &buffers);
+
+  //--------------------------------------------------
+  /** \brief Closes a comm opened by OpenComm.
+   */
+  void CloseComm (const std::string &comm_id);
 
-  const HmacFn hmac_fn_;
+private:
+  const ExecuteReply& GenericRun_ (
+      const std::string &code, const std::vector<std::string> &variable_names);
+  void RunProfiled_ (const std::string &code);
+  void Send_ (const SerializedMessage &message,
+              const std::vector<Frame> &buffers = {});
+  void ReceiveContent_ (void);
+  void ReceiveReply_ (ExecuteReply *reply);
+
+  const IPythonHmac hmac_;
   const std::string ident_;
-  const MessageBuilder message_builder_;
+  MessageBuilder message_builder_;
   zmq::socket_t socket_; 
   const std::string uri_;
+  const TransportOptions options_;
+  int protocol_version_;
+  bool profiling_;
+  size_t profile_functions_;
+  bool profile_memory_;
+  // Whether the profiling wrapper is defined in the kernel yet
+  bool profile_defined_;
+  ExecutionProfile profile_;
+
+  // Reused between calls so steady state messaging does not allocate.
+  SerializedMessage request_;
+  ExecuteReply reply_;
+  zmq::message_t frame_;
+  zmq::message_t content_;
+};
+
+
+//======================================================================
+/** \brief A subscription to the IOPub socket of an iPython kernel, which
+ * broadcasts outputs and the replies to comm messages.
+ *
+ * Only what CommChannel needs is implemented: waiting for the reply to a
+ * particular comm_msg.
+ */
+class IOPubConnection {
+public:
+  //--------------------------------------------------
+  /** \brief Configure a new IOPub connection without connecting.
+   */
+  IOPubConnection (const IPyKernelConfig &config, zmq::context_t &context,
+                   const TransportOptions &options = TransportOptions{}) :
+      socket_(context, ZMQ_SUB),
+      uri_{BuildUri(config, PortType::IOPUB)},
+      options_{options}
+  {}
+
+  //--------------------------------------------------
+  /** \brief Connect and subscribe to everything.
+   */
+  void Connect (void);
+
+  //--------------------------------------------------
+  /** \brief Returns whether a message arrives within timeout_ms.
+   */
+  bool Poll (long timeout_ms);
+
+  //--------------------------------------------------
+  /** \brief Drops every message received so far.
+   */
+  void Discard (void);
+
+  //--------------------------------------------------
+  /** \brief Waits for the comm_msg sent in reply to the message with
+   * parent_msg_id.  Its data must have "status": "Success", as for
+   * DataChannel::Request.
+   *
+   * \throws std::runtime_error  if the kernel reports a failure, goes idle
+   *                             without replying, or sends nothing within
+   *                             TransportOptions::reply_timeout_ms.
+   *
+   * \returns the binary buffers of the reply.
+   */
+  std::vector<zmq::message_t> ReceiveCommReply (
+      const std::string &parent_msg_id);
+
+private:
+  bool ReceiveMessage_ (void);
+
+  zmq::socket_t socket_;
+  const std::string uri_;
+  const TransportOptions options_;
+
+  // [signature, header, parent, metadata, content, buffers...]
+  std::vector<zmq::message_t> frames_;
+  std::string value_;
 };
 
 
@@ -342,8 +654,11 @@ public:
    * but does not connect sockets.
    *
    * \param config  configuration for the IPython kernel.
+   * \param options  socket settings for the connections.
    */
-  explicit IPythonSession (const IPyKernelConfig &config);
+  explicit IPythonSession (
+      const IPyKernelConfig &config,
+      const TransportOptions &options = TransportOptions{});
 
   //--------------------------------------------------
   /** \brief Connect to the IPython kernel.
@@ -355,10 +670,18 @@ public:
    */
   ShellConnection& Shell (void) { return shell_connection_; }
 
+  //--------------------------------------------------
+  /** \brief Returns a reference to the IOPub socket connection, connecting
+   * it on first use.
+   */
+  IOPubConnection& IOPub (void);
+
 private:
   const IPyKernelConfig config_;
   zmq::context_t zmq_context_;
   ShellConnection shell_connection_;  
+  IOPubConnection iopub_connection_;
+  bool iopub_connected_;
 };
 
 } // namespace
@@ -4,24 +4,281 @@
 # full text in LICENSE file in root folder of this project.
 # 
 
+import io
 import os
+import platform
+import tempfile
 import time
 import signal
 import struct
 import sys
-import Queue
+from collections import OrderedDict, deque
 
 import numpy as np
 import zmq
 
 import threading 
 
-class ListenerThread(threading.Thread):
+def asStr(data):
+  # Variable names arrive as bytes, but globals are keyed by str
+  return data if isinstance(data, str) else data.decode('utf-8')
+
+
+# Seconds a chunked transfer may go without a chunk before it is abandoned,
+# e.g. because its sender died
+STAGE_TIMEOUT = 60.0
+# Largest frame that may be sent in chunks, so a corrupt or hostile header
+# cannot make the listener allocate without bound
+STAGE_MAX_BYTES = 16 << 30
+# Seconds an idle client with nothing queued is kept: briefly if forgetting
+# it loses nothing, and a day if it said hello or asked to be urgent
+CLIENT_TIMEOUT = 60.0
+CLIENT_STATE_TIMEOUT = 24 * 3600.0
+
+
+class ListenerClient(object):
+  # One connected C++ process.  Until it says hello it is anonymous, with
+  # no prefix and the default weight.
+  def __init__(self):
+    self.name = None
+    self.prefix = ''
+    self.weight = 1.0
+    # Urgent clients are served before all others
+    self.urgent = False
+    self.requests = deque()
+    # Virtual finish time of the client's last queued request
+    self.finish = 0.0
+    # Frames being received in chunks, by transfer id, with the bytes
+    # received so far and the time of their last chunk
+    self.staged = {}
+    # When the client last sent anything
+    self.active = time.time()
+
+  def expireStaged(self, now):
+    for transfer in [transfer for transfer, (buffer, received, chunk_time)
+                     in self.staged.items()
+                     if now - chunk_time > STAGE_TIMEOUT]:
+      del self.staged[transfer]
+
+  def expired(self, now):
+    if self.requests or self.staged:
+      return False
+    stateful = self.name is not None or self.urgent
+    timeout = CLIENT_STATE_TIMEOUT if stateful else CLIENT_TIMEOUT
+    return now - self.active > timeout
+
+
+class BufferFrame(object):
+  # The parts of the zmq.Frame interface the processors use, over one of
+  # the binary buffers of a comm message, or a staged frame that the
+  # processors may keep since nothing else refers to it
+  def __init__(self, buffer, owned=False):
+    self.buffer = memoryview(buffer).cast('B')
+    self.owned = owned
+
+  @property
+  def bytes(self):
+    return self.buffer.tobytes()
+
+  def __len__(self):
+    return len(self.buffer)
+
+
+class AffineAxis(object):
+  # start + step * arange(count) as a 1D float64 array, computed only when
+  # something needs the values, then kept read-only.  Lengths, single
+  # values and slices are answered without computing anything else.
+  def __init__(self, start, step, count):
+    self.start = start
+    self.step = step
+    self.count = count
+    self.shape = (count,)
+    self.ndim = 1
+    self.size = count
+    self.dtype = np.dtype(np.float64)
+    self.materialized = None
+
+  OWN = ('start', 'step', 'count', 'materialized')
+
+  def values(self):
+    if self.materialized is None:
+      values = self.start + self.step * np.arange(self.count, dtype=np.float64)
+      values.flags.writeable = False
+      self.materialized = values
+    return self.materialized
+
+  def __array__(self, dtype=None, copy=None):
+    values = self.values()
+    if dtype is not None and np.dtype(dtype) != values.dtype:
+      return values.astype(dtype)
+    return values.copy() if copy else values
+
+  def __len__(self):
+    return self.count
+
+  def __getitem__(self, key):
+    if isinstance(key, slice):
+      first, stop, stride = key.indices(self.count)
+      count = len(range(first, stop, stride))
+      return AffineAxis(self.start + self.step * first, self.step * stride,
+                        count)
+    if isinstance(key, (int, np.integer)):
+      index = int(key)
+      if index < 0:
+        index += self.count
+      if not 0 <= index < self.count:
+        raise IndexError("index %d is out of bounds for axis of size %d" %
+                         (key, self.count))
+      return self.start + self.step * index
+    return self.values()[key]
+
+  def __iter__(self):
+    return iter(self.values())
+
+  def __getattr__(self, name):
+    # Everything else an array has, e.g. mean or reshape.  Special and own
+    # attributes are not looked up, e.g. while copying.
+    if name.startswith('__') or name in self.__class__.OWN:
+      raise AttributeError(name)
+    return getattr(self.values(), name)
+
+  def __repr__(self):
+    return "AffineAxis(start=%r, step=%r, count=%d)" % (self.start, self.step,
+                                                         self.count)
+
+def affineOperator(name):
+  return lambda self, *args: getattr(self.values(), name)(*args)
+
+# Arithmetic and comparisons work on the values
+for operator in ['add', 'sub', 'mul', 'truediv', 'floordiv', 'mod', 'pow',
+                 'radd', 'rsub', 'rmul', 'rtruediv', 'rfloordiv', 'rmod',
+                 'rpow', 'lt', 'le', 'gt', 'ge', 'eq', 'ne', 'neg', 'pos',
+                 'abs']:
+  setattr(AffineAxis, '__%s__' % operator,
+          affineOperator('__%s__' % operator))
+
+
+class RemoteSeries(object):
+  # A SeriesPyramid left in the C++ process, fetched a window at a time from
+  # its ZoomServer
+  def __init__(self, endpoint, source, count, x_start, x_step):
+    self.endpoint = endpoint
+    self.source = source
+    self.count = count
+    self.x_start = x_start
+    self.x_step = x_step
+    self.lines = []
+    self.socket = None
+    # Set when the series grew, on whichever thread learnt of it
+    self.stale = False
+    # Fetches come from both user code and the GUI thread
+    self.lock = threading.Lock()
+
+  def fetch(self, x0, x1, pixels):
+    # Returns x and y for the window at about pixels points across, tracing
+    # the min/max envelope when zoomed out, or None if the C++ process did
+    # not answer
+    first = int(np.floor((x0 - self.x_start) / self.x_step))
+    last = int(np.ceil((x1 - self.x_start) / self.x_step)) + 1
+    first = int(np.clip(first, 0, self.count))
+    last = int(np.clip(last, first, self.count))
+    request = [b"zoom", self.source, struct.pack('<QQI', first, last, pixels)]
+
+    with self.lock:
+      if self.socket is None:
+        self.socket = zmq.Context.instance().socket(zmq.REQ)
+        self.socket.setsockopt(zmq.RCVTIMEO, 2000)
+        self.socket.setsockopt(zmq.LINGER, 0)
+        self.socket.connect(self.endpoint)
+      try:
+        self.socket.send_multipart(request)
+        reply = self.socket.recv_multipart()
+      except zmq.error.ZMQError:
+        # A REQ socket that timed out cannot be used again
+        self.socket.close()
+        self.socket = None
+        return None
+
+    if reply[0] != b"Success":
+      raise RuntimeError(asStr(reply[0]))
+    level, block, start, points = struct.unpack('<BQQQ', reply[1])
+    mins = np.frombuffer(reply[2], dtype='<f8')
+    if level == 0:
+      x = self.x_start + self.x_step * (start + np.arange(points))
+      return x, mins
+    maxs = np.frombuffer(reply[3], dtype='<f8')
+    centers = start + block * (np.arange(points) + 0.5)
+    x = np.repeat(self.x_start + self.x_step * centers, 2)
+    y = np.empty(2 * points)
+    y[0::2] = mins
+    y[1::2] = maxs
+    return x, y
+
+  def refresh(self, axes=None):
+    # Refetches the view of every line showing the series, or just those on
+    # axes, e.g. from its xlim_changed callback
+    for line in self.lines:
+      if axes is not None and line.axes is not axes:
+        continue
+      x0, x1 = line.axes.get_xlim()
+      pixels = int(line.axes.get_window_extent().width) or 1000
+      data = self.fetch(x0, x1, pixels)
+      if data is not None:
+        line.set_data(*data)
+        line.figure.canvas.draw_idle()
+
+  def refreshStale(self):
+    # Refreshes if the series grew, from a timer on the GUI thread as
+    # matplotlib is not thread safe
+    if self.stale:
+      self.stale = False
+      self.refresh()
+
+
+class MessageProcessor(object):
+  # Turns requests from C++ into variables, whether they arrive at the
+  # listener thread or as comm messages.
   def __init__(self, global_env):
-    super(ListenerThread, self).__init__()
-    self.running = True
     self.global_env = global_env
-    self.port = None
+    # ImageStream buffers and the AxesImages showing them, by name, and the
+    # names with frames not yet shown
+    self.streams = {}
+    self.stream_images = {}
+    self.stale_streams = set()
+    # Data extents of DensityGrids, by name
+    self.density_extents = {}
+    # Content addressed buffers of arrays sent with deduplication, least
+    # recently used first
+    self.cache = OrderedDict()
+    self.cache_bytes = 0
+    self.cache_capacity = 256 << 20
+    # Connected clients by routing id and by comm id, and the one being
+    # served.  The first are only touched by the listener thread, the
+    # second only by the kernel's main thread.
+    self.clients = {}
+    self.comm_clients = {}
+    self.client = ListenerClient()
+    # Multipart messages start with a frame naming one of these commands,
+    # single frame messages are plain arrays for processData.
+    self.commands = {
+        b"fetch" : self.processFetch,
+        b"render" : self.processRender,
+        b"table" : self.processTable,
+        b"frame" : self.processFrame,
+        b"sparse" : self.processSparse,
+        b"density" : self.processDensity,
+        b"quantized" : self.processQuantized,
+        b"update" : self.processUpdate,
+        b"pyramid" : self.processPyramid,
+        b"axis" : self.processAxis,
+        b"hello" : self.processHello,
+        b"priority" : self.processPriority,
+        b"stage" : self.processStage,
+        b"staged" : self.processStaged,
+        b"cache_size" : self.processCacheSize,
+        b"cached" : self.processCached,
+        b"bind" : self.processBind,
+        }
 
 
   def decodeData(self, message):
@@ -35,79 +292,716 @@ class ListenerThread(threading.Thread):
 
     dtype = {4 : np.float32,
          8 : np.float64}[size]
-    data = np.fromstring(message[9:9+length], dtype=dtype)
+    data = np.frombuffer(message, dtype=dtype, count=rows*cols, offset=9)
     data = data.reshape(rows, cols)
 
     if len(message[9+length:]) == 0:
         return False, "Message has zero length name field"
 
-    name = message[9+length:]
+    name = self.qualify(bytes(message[9+length:]))
 
     return data, name
 
 
+  def qualify(self, name):
+    # Variables are namespaced by the prefix of the client that sent them
+    return self.client.prefix + asStr(name)
+
+
+  def processData(self, frame):
+    # One copy, into a buffer the array can own and that stays writable,
+    # unless the frame was staged into one already
+    if getattr(frame, 'owned', False):
+      message = frame.buffer.obj
+    else:
+      message = bytearray(frame.buffer)
+    data, name = self.decodeData(message)
+    if data is False:
+        return data, name
+
+    self.global_env[name] = data
+    return True, []
+
+
+  def trimCache(self):
+    while self.cache_bytes > self.cache_capacity and self.cache:
+      key, buffer = self.cache.popitem(last=False)
+      self.cache_bytes -= len(buffer)
+
+
+  def processCacheSize(self, frames):
+    self.cache_capacity = int(frames[0].bytes)
+    self.trimCache()
+    return True, []
+
+
+  def processCached(self, frames):
+    # Kept as immutable bytes, so the arrays bound to it are read-only and
+    # can all share it
+    key = frames[0].bytes
+    buffer = frames[1].bytes
+    data, name = self.decodeData(buffer)
+    if data is False:
+      return data, name
+
+    if key in self.cache:
+      self.cache_bytes -= len(self.cache.pop(key))
+    self.cache[key] = buffer
+    self.cache_bytes += len(buffer)
+    self.trimCache()
+    self.global_env[name] = data
+    return True, []
+
+
+  def processBind(self, frames):
+    key = frames[0].bytes
+    if key not in self.cache:
+      return False, "Not cached"
+
+    # Reinserting makes it the most recently used
+    buffer = self.cache.pop(key)
+    self.cache[key] = buffer
+    data, _ = self.decodeData(buffer)
+    self.global_env[self.qualify(frames[1].bytes)] = data
+    return True, []
+
+
+  def processUpdate(self, frames):
+    rows, cols, full = struct.unpack_from('<IIB', frames[0].bytes)
+    name = self.qualify(frames[0].bytes[9:])
+    ranges = np.frombuffer(frames[1].buffer, dtype='<u8').reshape(-1, 2)
+    values = np.frombuffer(frames[2].buffer, dtype='<f8')
+
+    # Only an array this client could have sent is patched, so one that was
+    # reassigned, resized or is shared read-only is replaced instead.
+    data = self.global_env.get(name)
+    if full:
+      data = np.empty((rows, cols))
+      self.global_env[name] = data
+    elif (not isinstance(data, np.ndarray) or data.shape != (rows, cols) or
+          data.dtype != np.float64 or not data.flags.c_contiguous or
+          not data.flags.writeable):
+      return False, "No previous array for " + name
+
+    flat = data.reshape(-1)
+    offset = 0
+    for begin, end in ranges:
+      flat[begin:end] = values[offset:offset + end - begin]
+      offset += end - begin
+    return True, []
+
+
+  def processAxis(self, frames):
+    start, step, count = struct.unpack_from('<ddQ', frames[0].bytes)
+    name = self.qualify(frames[0].bytes[24:])
+    if len(frames) == 1:
+      self.global_env[name] = AffineAxis(start, step, count)
+      return True, []
+
+    # Not affine after all, so the values came too
+    values = np.frombuffer(frames[1].buffer, dtype='<f8')
+    if len(values) != count:
+      return False, "Axis %s has the wrong length" % name
+    self.global_env[name] = values.copy()
+    return True, []
+
+
+  def processPyramid(self, frames):
+    count, x_start, x_step = struct.unpack_from('<Qdd', frames[0].bytes)
+    source = frames[0].bytes[24:]
+    name = self.qualify(source)
+    endpoint = asStr(frames[1].bytes)
+
+    # Sent again as the series grows, when the plots showing it refetch
+    series = self.global_env.get(name)
+    if (isinstance(series, RemoteSeries) and series.endpoint == endpoint and
+        series.source == source):
+      series.count, series.x_start, series.x_step = count, x_start, x_step
+      series.stale = True
+    else:
+      self.global_env[name] = RemoteSeries(endpoint, source, count, x_start,
+                                           x_step)
+    return True, []
+
+
+  def processHello(self, frames):
+    # Introduces a client: its name, variable prefix and scheduling weight
+    weight = float(frames[2].bytes)
+    if weight <= 0:
+      return False, "Client weight must be positive"
+    self.client.name = asStr(frames[0].bytes)
+    self.client.prefix = asStr(frames[1].bytes)
+    self.client.weight = weight
+    return True, []
+
+
+  def processPriority(self, frames):
+    self.client.urgent = frames[0].bytes == b"urgent"
+    return True, []
+
+
+  def processStage(self, frames):
+    # One chunk of a frame too large to send whole, see processStaged
+    # Chunks arrive in order, so a frame is whole once its received count
+    # reaches its size.
+    transfer, size, offset = struct.unpack('<QQQ', frames[0].bytes)
+    if transfer in self.client.staged:
+      buffer, received, _ = self.client.staged[transfer]
+    elif offset != 0:
+      return False, "Chunk of an unknown transfer"
+    elif size > STAGE_MAX_BYTES:
+      return False, "Staged frame larger than %d bytes" % STAGE_MAX_BYTES
+    else:
+      # Left uninitialized, as zeroing gigabytes would stall the listener
+      buffer = np.empty(size, dtype=np.uint8)
+      received = 0
+    chunk = np.frombuffer(frames[1].buffer, dtype=np.uint8)
+    if offset != received or offset + len(chunk) > len(buffer):
+      self.client.staged.pop(transfer, None)
+      return False, "Chunk out of order or beyond the end of its frame"
+    buffer[offset:offset + len(chunk)] = chunk
+    self.client.staged[transfer] = (buffer, received + len(chunk), time.time())
+    return True, []
+
+
+  def processStaged(self, frames):
+    # A request whose large frames went ahead in chunks.  The first frame
+    # holds a transfer id per frame of the request, 0 for those sent whole.
+    if len(frames[0]) != 8 * (len(frames) - 1):
+      return False, "Malformed staged request"
+    transfers = struct.unpack('<%dQ' % (len(frames) - 1), frames[0].bytes)
+    request = []
+    for transfer, frame in zip(transfers, frames[1:]):
+      if transfer == 0:
+        request.append(frame)
+        continue
+      staged = self.client.staged.pop(transfer, None)
+      if staged is None:
+        return False, "No staged frame for a request"
+      buffer, received, _ = staged
+      if received != len(buffer):
+        return False, "Staged frame missing %d bytes" % (len(buffer) - received)
+      request.append(BufferFrame(buffer, owned=True))
+    return self.processMessage(request)
+
+
+  def fetchReply(self, data):
+    # [header, raw buffer], where header is the dtype kind, item size and
+    # ndim followed by ndim uint64 dimensions.
+    data = np.ascontiguousarray(data, dtype=data.dtype.newbyteorder('<'))
+    header = struct.pack('<cBB', data.dtype.kind.encode('ascii'),
+                         data.dtype.itemsize, data.ndim)
+    header += struct.pack('<%dQ' % data.ndim, *data.shape)
+    return [header, data]
+
+
+  def processFetch(self, frames):
+    name = asStr(frames[0].bytes)
+    if name not in self.global_env:
+      return False, "No variable named " + name
+
+    data = np.asarray(self.global_env[name])
+    if data.dtype.kind not in "fiub":
+      return False, "Cannot fetch %s with dtype %s" % (name, data.dtype)
+    return True, self.fetchReply(data)
+
+
+  def processRender(self, frames):
+    # Replies as processFetch does, with a (height, width, 4) array for
+    # rgba, otherwise the encoded file as a flat array of bytes
+    figure = asStr(frames[0].bytes)
+    image_format = asStr(frames[1].bytes).lower()
+    dpi = float(frames[2].bytes)
+
+    # The current figure, a figure number, or a variable holding a figure
+    if figure == "" or figure.isdigit():
+      from matplotlib._pylab_helpers import Gcf
+      manager = (Gcf.get_active() if figure == "" else
+                 Gcf.get_fig_manager(int(figure)))
+      if manager is None:
+        return False, "No figure " + (figure or "is open")
+      fig = manager.canvas.figure
+    else:
+      fig = self.global_env.get(figure)
+      if not hasattr(fig, 'savefig'):
+        return False, "No figure named " + figure
+
+    dpi = dpi or fig.dpi
+    if image_format in ('rgba', 'raw'):
+      # Drawn on an Agg canvas of its own, whose buffer has the size Agg
+      # chose from the figure's bbox, then the figure is handed back
+      from matplotlib.backends.backend_agg import FigureCanvasAgg
+      original_canvas, original_dpi = fig.canvas, fig.dpi
+      try:
+        canvas = FigureCanvasAgg(fig)
+        fig.dpi = dpi
+        canvas.draw()
+        data = np.asarray(canvas.buffer_rgba())
+      except Exception as e:
+        return False, "Cannot render %s: %s" % (figure or "figure", e)
+      finally:
+        fig.dpi = original_dpi
+        fig.set_canvas(original_canvas)
+      return True, self.fetchReply(data)
+
+    # savefig renders with Agg whatever the backend, so this works headless
+    buffer = io.BytesIO()
+    try:
+      fig.savefig(buffer, format=image_format, dpi=dpi)
+    except Exception as e:
+      return False, "Cannot render %s: %s" % (figure or "figure", e)
+    data = np.frombuffer(buffer.getbuffer(), dtype=np.uint8)
+    return True, self.fetchReply(data)
+
+
+  # numpy dtypes of Table::ColumnType, in enum order.  None marks the
+  # timestamp and category types, which are handled specially.
+  TABLE_DTYPES = ['<f8', '<f4', '<i8', '<i4', '<i2', 'i1',
+                  '<u8', '<u4', '<u2', 'u1', '?', None, None]
+  TABLE_TIMESTAMP = 11
+  TABLE_CATEGORY = 12
+
+
+  def processTable(self, frames):
+    try:
+      import pandas as pd
+    except ImportError:
+      return False, "pandas is required to receive a Table"
+
+    header = frames[0].bytes
+    def readString(offset):
+      length, = struct.unpack_from('<I', header, offset)
+      offset += 4
+      return asStr(header[offset:offset+length]), offset + length
+
+    name, offset = readString(0)
+    name = self.qualify(name)
+    rows, ncols = struct.unpack_from('<QI', header, offset)
+    offset += 12
+
+    # Columns are built directly on the received buffers, without copying
+    buffers = iter(frames[1:])
+    columns = OrderedDict()
+    for i in range(ncols):
+      kind, = struct.unpack_from('<B', header, offset)
+      column_name, offset = readString(offset + 1)
+      if kind == self.TABLE_TIMESTAMP:
+        values = np.frombuffer(next(buffers).buffer, dtype='<i8')
+        values = values.view('datetime64[ns]')
+      elif kind == self.TABLE_CATEGORY:
+        codes = np.frombuffer(next(buffers).buffer, dtype='<i4')
+        offsets = np.frombuffer(next(buffers).buffer, dtype='<i4')
+        chars = next(buffers).bytes
+        categories = [chars[offsets[j]:offsets[j+1]].decode('utf-8')
+                      for j in range(len(offsets) - 1)]
+        values = pd.Categorical.from_codes(codes, categories)
+      else:
+        values = np.frombuffer(next(buffers).buffer,
+                               dtype=self.TABLE_DTYPES[kind])
+      if len(values) != rows:
+        return False, "Column %s has the wrong length" % column_name
+      columns[column_name] = values
+
+    self.global_env[name] = pd.DataFrame(columns, copy=False)
+    return True, []
+
+
+  def processSparse(self, frames):
+    try:
+      import scipy.sparse
+    except ImportError:
+      return False, "scipy is required to receive a SparseMatrix"
+
+    layout, rows, cols = struct.unpack_from('<BQQ', frames[0].bytes)
+    name = self.qualify(frames[0].bytes[17:])
+    indices0 = np.frombuffer(frames[1].buffer, dtype='<i4')
+    indices1 = np.frombuffer(frames[2].buffer, dtype='<i4')
+    values = np.frombuffer(frames[3].buffer, dtype='<f8')
+
+    # The matrices are built directly on the received buffers
+    if layout == 0:
+      matrix = scipy.sparse.csr_matrix((values, indices1, indices0),
+                                       shape=(rows, cols), copy=False)
+    elif layout == 1:
+      matrix = scipy.sparse.csc_matrix((values, indices1, indices0),
+                                       shape=(rows, cols), copy=False)
+    elif layout == 2:
+      matrix = scipy.sparse.coo_matrix((values, (indices0, indices1)),
+                                       shape=(rows, cols), copy=False)
+    else:
+      return False, "Unknown sparse layout %d" % layout
+
+    self.global_env[name] = matrix
+    return True, []
+
+
+  def processDensity(self, frames):
+    width, height, x_min, x_max, y_min, y_max = struct.unpack_from(
+        '<IIdddd', frames[0].bytes)
+    name = self.qualify(frames[0].bytes[40:])
+    grid = np.frombuffer(frames[1].buffer, dtype='<f8')
+    self.global_env[name] = grid.reshape(height, width)
+    self.density_extents[name] = (x_min, x_max, y_min, y_max)
+    return True, []
+
+
+  # numpy dtypes of QuantizedArray::Encoding, in enum order.  The integer
+  # encodings reserve their largest code for NaN.
+  QUANTIZED_DTYPES = ['u1', '<u2', '<f2', '<f4', '<f8']
+  QUANTIZED_INTEGERS = 2
+
+
+  def processQuantized(self, frames):
+    rows, cols, encoding, chunk = struct.unpack_from('<IIBI', frames[0].bytes)
+    name = self.qualify(frames[0].bytes[13:])
+    params = np.frombuffer(frames[1].buffer, dtype='<f8').reshape(-1, 2)
+    codes = np.frombuffer(frames[2].buffer,
+                          dtype=self.QUANTIZED_DTYPES[encoding])
+    count = rows * cols
+    if len(codes) != count or len(params) != (count + chunk - 1) // chunk:
+      return False, "Quantized array %s has the wrong length" % name
+
+    # Dequantize a chunk per row, padding the last chunk out to full size
+    data = np.empty(len(params) * chunk)
+    data[:count] = codes
+    chunks = data.reshape(len(params), chunk)
+    chunks *= params[:, 1:]
+    chunks += params[:, :1]
+    data = data[:count]
+    if encoding < self.QUANTIZED_INTEGERS:
+      data[codes == np.iinfo(codes.dtype).max] = np.nan
+
+    self.global_env[name] = data.reshape(rows, cols)
+    return True, []
+
+
+  def processFrame(self, frames):
+    width, height, tile, channels, itemsize, full = struct.unpack_from(
+        '<IIIBBB', frames[0].bytes)
+    name = self.qualify(frames[0].bytes[15:])
+    tiles_x = (width + tile - 1) // tile
+    tiles_y = (height + tile - 1) // tile
+    dtype = {1 : np.uint8, 2 : np.uint16}[itemsize]
+
+    # The persistent buffer is padded to whole tiles, so every tile is the
+    # same shape and can be patched with one fancy indexing assignment.
+    padded = self.streams.get(name)
+    shape = (tiles_y * tile, tiles_x * tile, channels)
+    if padded is None or padded.shape != shape or padded.dtype != dtype:
+      if not full:
+        return False, "No previous frame for " + name
+      padded = np.zeros(shape, dtype=dtype)
+      self.streams[name] = padded
+      image = padded[:height, :width]
+      self.global_env[name] = image[:, :, 0] if channels == 1 else image
+
+    indices = np.frombuffer(frames[1].buffer, dtype='<u4')
+    data = np.frombuffer(frames[2].buffer, dtype=dtype)
+    data = data.reshape(len(indices), tile, tile, channels)
+    tiles = padded.reshape(tiles_y, tile, tiles_x, tile, channels)
+    tiles = tiles.transpose(0, 2, 1, 3, 4)
+    tiles[indices // tiles_x, indices % tiles_x] = data
+
+    # Shown by redrawStreams on the GUI thread, as matplotlib is not thread
+    # safe and this may be the listener thread
+    if name in self.stream_images:
+      self.stale_streams.add(name)
+    return True, []
+
+
+  def redrawStreams(self):
+    while self.stale_streams:
+      name = self.stale_streams.pop()
+      image = self.stream_images.get(name)
+      if image is not None:
+        image.set_data(self.global_env[name])
+        image.figure.canvas.draw_idle()
+
+
+  def processMessage(self, frames):
+    if len(frames) == 1:
+      return self.processData(frames[0])
+
+    command = frames[0].bytes
+    if command not in self.commands:
+      return False, "Unknown command " + asStr(command)
+    return self.commands[command](frames[1:])
+
+
+class ListenerThread(threading.Thread):
+  # Serves clients connecting to a port of its own, for kernels older than
+  # messaging protocol 5.
+  def __init__(self, processor):
+    super(ListenerThread, self).__init__()
+    self.running = True
+    self.processor = processor
+    self.port = None
+    self.ipc_endpoint = None
+    self.virtual_time = 0.0
+    self.pruned = time.time()
+
+
   def stop(self):
     self.running = False
 
 
-  def sendString(self, socket, string):
+  def sendFrames(self, socket, frames):
     try:
-      socket.send(b"Success" + chr(0))
+      socket.send_multipart(frames, copy=False)
     except zmq.error.ZMQError as e:
       return False
     return True
 
 
-  def sendSuccess(self, socket):
-    return self.sendString(socket, "Success")
+  def sendSuccess(self, socket, envelope, frames=[]):
+    return self.sendFrames(socket, envelope + [b"Success"] + frames)
 
 
-  def sendFailure(self, socket, message):
-    return self.sendString(socket, message)
+  def sendFailure(self, socket, envelope, message):
+    return self.sendFrames(socket, envelope + [message.encode('utf-8')])
 
 
-  def processData(self, data_message):
-    data, name = self.decodeData(data_message)
-    if data is False:
-        return data, name
+  def enqueue(self, frames):
+    # Frames arrive as [routing id, empty delimiter, request...].  Each
+    # request is tagged with the virtual time it would finish if every
+    # client had a share of the listener proportional to its weight.
+    clients = self.processor.clients
+    routing_id = frames[0].bytes
+    client = clients.get(routing_id)
+    if client is None:
+      client = clients[routing_id] = ListenerClient()
+    client.active = time.time()
+    size = 0
+    for frame in frames[2:]:
+      size += len(frame)
+    start = client.finish
+    if start < self.virtual_time:
+      start = self.virtual_time
+    client.finish = start + size / client.weight
+    client.requests.append((client.finish, start, frames))
 
-    self.global_env[name] = data
-    return True, name
+
+  def prune(self):
+    # Drops abandoned transfers, then clients that are gone.  Routing ids
+    # are new for every connection, so without this they pile up.
+    now = time.time()
+    if now - self.pruned < 1.0:
+      return
+    self.pruned = now
+    clients = self.processor.clients
+    for routing_id, client in list(clients.items()):
+      client.expireStaged(now)
+      if client.expired(now) and client is not self.processor.client:
+        del clients[routing_id]
+
+
+  def serveNext(self, socket):
+    # Urgent clients first, then weighted fair queuing: serve the earliest
+    # finishing request, so small updates overtake bulk transfers queued by
+    # other clients.  (The builtins are avoided here as pylab shadows min,
+    # max and sum.)
+    client = None
+    for candidate in self.processor.clients.values():
+      if not candidate.requests:
+        continue
+      if (client is None or candidate.urgent > client.urgent or
+          (candidate.urgent == client.urgent and
+           candidate.requests[0][0] < client.requests[0][0])):
+        client = candidate
+    finish, start, frames = client.requests.popleft()
+    self.virtual_time = start
+    self.processor.client = client
+
+    try:
+      success, message = self.processor.processMessage(frames[2:])
+    except Exception as e:
+      # Always reply, or the C++ side is left waiting
+      success, message = False, "%s: %s" % (type(e).__name__, e)
+    envelope = frames[:2]
+    if success:
+      self.sendSuccess(socket, envelope, message)
+    else:
+      self.sendFailure(socket, envelope, message)
 
 
   def run(self):
     context = zmq.Context()
 
-    data_socket = context.socket(zmq.REP)
-    self.port = data_socket.bind_to_random_port("tcp://*")
+    data_socket = context.socket(zmq.ROUTER)
+    data_socket.setsockopt(zmq.SNDBUF, 4 << 20)
+    data_socket.setsockopt(zmq.RCVBUF, 4 << 20)
+    port = data_socket.bind_to_random_port("tcp://*")
 
-    poller = zmq.Poller()
-    poller.register(data_socket, flags = zmq.POLLIN)
-
-    processors = {
-        data_socket : self.processData,
-        }
+    # Clients on this host can skip TCP with a Unix domain socket, unless
+    # the path does not fit in one, in which case TCP it is.
+    if zmq.has("ipc"):
+      path = os.path.join(tempfile.gettempdir(),
+                          "cpp-matplotlib-%d-%d" % (os.getpid(), port))
+      try:
+        data_socket.bind("ipc://" + path)
+        self.ipc_endpoint = "ipc://" + path
+      except zmq.error.ZMQError:
+        pass
+    self.port = port
 
+    waiting = 0
     while self.running:
-      for socket, event in poller.poll(timeout=20):
-        try:
-          if event:
-            message = socket.recv()
-            success, message = processors[socket](message)
-            if success:
-              self.sendSuccess(socket)
-            else:
-              self.sendFailure(socket, message)
-        except zmq.error.ZMQError as e:
-          # there was a transmit error...oops...die
-          self.running = False
-          continue
-
-
-def cpp_ipython_start_thread(global_env):
-  listener_thread = ListenerThread(global_env)
+      try:
+        # Take in everything that has arrived before choosing what to serve
+        timeout = 0 if waiting else 20
+        while data_socket.poll(timeout):
+          self.enqueue(data_socket.recv_multipart(copy=False))
+          waiting += 1
+          timeout = 0
+        if waiting:
+          self.serveNext(data_socket)
+          waiting -= 1
+        self.prune()
+      except zmq.error.ZMQError as e:
+        # there was a transmit error...oops...die
+        self.running = False
+        continue
+
+    data_socket.close(linger=0)
+    context.term()
+    if self.ipc_endpoint is not None and os.path.exists(self.ipc_endpoint[6:]):
+      os.remove(self.ipc_endpoint[6:])
+
+
+def cpp_ipython_gui_timer(figure, callback, interval=50):
+  # Calls callback every interval ms on the thread this is called from,
+  # which should be the GUI thread, for as long as the timer is referenced
+  timer = figure.canvas.new_timer(interval=interval)
+  timer.add_callback(callback)
+  timer.start()
+  return timer
+
+
+def cpp_ipython_show_stream(name, **kwargs):
+  # Shows an ImageStream with imshow and keeps it updated as frames arrive
+  import matplotlib.pyplot as plt
+  processor = globals()["cpp_ipython_listener_processor"]
+  image = plt.imshow(globals()[name], **kwargs)
+  processor.stream_images[name] = image
+  image.cpp_ipython_timer = cpp_ipython_gui_timer(image.figure,
+                                                  processor.redrawStreams)
+  return image
+
+
+def cpp_ipython_show_density(name, **kwargs):
+  # Shows a DensityGrid with imshow over the data range it was binned from
+  import matplotlib.pyplot as plt
+  processor = globals()["cpp_ipython_listener_processor"]
+  options = dict(extent=processor.density_extents[name], origin='lower',
+                 aspect='auto', interpolation='nearest')
+  options.update(kwargs)
+  return plt.imshow(globals()[name], **options)
+
+
+def cpp_ipython_show_pyramid(name, **kwargs):
+  # Plots a SeriesPyramid over its whole length, and refetches the detail
+  # that fits whenever the plot is panned or zoomed
+  import matplotlib.pyplot as plt
+  series = globals()[name]
+  line, = plt.plot([], [], **kwargs)
+  series.lines.append(line)
+  line.axes.callbacks.connect('xlim_changed', series.refresh)
+  line.cpp_ipython_timer = cpp_ipython_gui_timer(line.figure,
+                                                 series.refreshStale)
+  end = series.x_start + series.x_step * (series.count - 1)
+  if end == series.x_start:
+    end += series.x_step
+  line.axes.set_xlim(series.x_start, end)
+  line.axes.relim()
+  line.axes.autoscale_view(scalex=False)
+  return line
+
+
+def cpp_ipython_prepare(key, code, parameters):
+  # Compiles code once for repeated runs by cpp_ipython_invoke
+  prepared = globals().setdefault("cpp_ipython_prepared", {})
+  prepared[key] = (compile(code, "<prepared %s>" % key, "exec"), parameters)
+
+
+def cpp_ipython_invoke(key, *args):
+  prepared = globals().get("cpp_ipython_prepared", {})
+  if key not in prepared:
+    raise KeyError("No prepared code %s, was the kernel restarted?" % key)
+  code, parameters = prepared[key]
+  if len(args) != len(parameters):
+    raise TypeError("Prepared code %s takes %d arguments, got %d" %
+                    (key, len(parameters), len(args)))
+  global_env = globals()
+  global_env.update(zip(parameters, args))
+  exec(code, global_env)
+
+
+def cpp_ipython_get_processor(global_env):
+  # Shared by the listener thread and comms, and replaced along with this
+  # code when a newer version of the library connects
+  processor = global_env.get("cpp_ipython_listener_processor")
+  if not isinstance(processor, MessageProcessor):
+    processor = MessageProcessor(global_env)
+    global_env["cpp_ipython_listener_processor"] = processor
+  return processor
+
+
+def cpp_ipython_register_comm(global_env, version=None):
+  # Protocol 5 kernels take data as binary buffers on comm messages over the
+  # shell socket, so no listener thread or port is needed
+  processor = cpp_ipython_get_processor(global_env)
+
+  def openComm(comm, open_msg):
+    client = ListenerClient()
+    processor.comm_clients[comm.comm_id] = client
+
+    def onMessage(msg):
+      now = time.time()
+      for other in list(processor.comm_clients.values()):
+        other.expireStaged(now)
+      processor.client = client
+      frames = [BufferFrame(buffer) for buffer in msg["buffers"]]
+      try:
+        success, reply = processor.processMessage(frames)
+      except Exception as e:
+        # Always reply, or the C++ side is left waiting
+        success, reply = False, "%s: %s" % (type(e).__name__, e)
+      if success:
+        comm.send({"status": "Success"}, buffers=reply)
+      else:
+        comm.send({"status": reply})
+
+    def onClose(msg):
+      processor.comm_clients.pop(comm.comm_id, None)
+
+    comm.on_msg(onMessage)
+    comm.on_close(onClose)
+
+  manager = getattr(get_ipython().kernel, "comm_manager", None)
+  if manager is None:
+    from comm import get_comm_manager
+    manager = get_comm_manager()
+  manager.register_target("cpp_matplotlib", openComm)
+  global_env["cpp_ipython_listener_version"] = version
+  return True
+
+
+def cpp_ipython_start_thread(global_env, version=None):
+  # Replace a listener left behind by an older version of the library
+  if "cpp_ipython_listener_thread" in global_env:
+    global_env["cpp_ipython_listener_thread"].stop()
+    global_env["cpp_ipython_listener_thread"].join()
+
+  listener_thread = ListenerThread(cpp_ipython_get_processor(global_env))
   listener_thread.start()
+  while listener_thread.port is None:
+    if not listener_thread.is_alive():
+      raise RuntimeError("The cpp-matplotlib listener thread failed to start")
+    time.sleep(0.001)
   global_env["cpp_ipython_listener_thread"] = listener_thread
   global_env["cpp_ipython_listener_thread_port"] = listener_thread.port
+  global_env["cpp_ipython_listener_thread_ipc"] = listener_thread.ipc_endpoint
+  global_env["cpp_ipython_listener_thread_host"] = platform.node()
+  global_env["cpp_ipython_listener_version"] = version
   return True
 
@@ -0,0 +1,84 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+// Measures the data channel's round trip latency and throughput over each
+// transport, e.g.
+//
+//   $ cpp-matplotlib-transport-benchmark ~/.ipython/.../kernel-NNN.json
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cpp_mpl.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+static double Seconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void Benchmark(const std::string &config_filename, const char *label,
+                      const cppmpl::TransportOptions &options) {
+  cppmpl::CppMatplotlib mpl{config_filename, options};
+  mpl.Connect();
+
+  // Latency: round trips of a tiny array
+  const int ROUND_TRIPS = 2000;
+  std::vector<cppmpl::NumpyArray::dtype> small(8, 1.0);
+  cppmpl::NumpyArray small_array{"BenchmarkSmall", small};
+  std::vector<double> latencies;
+  latencies.reserve(ROUND_TRIPS);
+  for (int i = 0; i < ROUND_TRIPS; ++i) {
+    auto start = Clock::now();
+    mpl.SendData(small_array);
+    latencies.push_back(Seconds(start));
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  // Throughput: 64 MB arrays
+  const int TRANSFERS = 16;
+  std::vector<cppmpl::NumpyArray::dtype> big(8 << 20, 1.0);
+  cppmpl::NumpyArray big_array{"BenchmarkBig", big};
+  auto start = Clock::now();
+  for (int i = 0; i < TRANSFERS; ++i) {
+    mpl.SendData(big_array);
+  }
+  const double elapsed = Seconds(start);
+  const double megabytes = TRANSFERS * big.size() * sizeof(big[0]) / 1e6;
+
+  printf("%-6s latency median %7.1f us  p99 %7.1f us  throughput %7.1f MB/s\n",
+         label, latencies[ROUND_TRIPS / 2] * 1e6,
+         latencies[ROUND_TRIPS * 99 / 100] * 1e6, megabytes / elapsed);
+
+  mpl.RunCode("del BenchmarkSmall, BenchmarkBig");
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " /path/to/kernel-PID.json"
+      << std::endl;
+    exit(-1);
+  }
+
+  cppmpl::TransportOptions ipc;
+  Benchmark(argv[1], "ipc", ipc);
+
+  cppmpl::TransportOptions tcp;
+  tcp.prefer_ipc = false;
+  Benchmark(argv[1], "tcp", tcp);
+
+  cppmpl::TransportOptions tcp_default;
+  tcp_default.prefer_ipc = false;
+  tcp_default.send_buffer = 0;
+  tcp_default.receive_buffer = 0;
+  Benchmark(argv[1], "tcp-os", tcp_default);
+
+  return 0;
+}
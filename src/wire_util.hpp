@@ -0,0 +1,53 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+// Helpers shared by the library's translation units.  Not installed.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cppmpl {
+
+//--------------------------------------------------
+/** \brief Appends the bytes of value, in host byte order, to buffer.
+ */
+template <typename T>
+inline void Append (const T &value, std::vector<uint8_t> *buffer) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t*>(&value);
+  buffer->insert(buffer->end(), bytes, bytes + sizeof(value));
+}
+
+//--------------------------------------------------
+/** \brief Runs fn(0) ... fn(threads-1) concurrently, the first on this
+ * thread.
+ */
+inline void RunOnThreads (size_t threads,
+                          const std::function<void(size_t)> &fn) {
+  std::vector<std::thread> workers;
+  for (size_t t = 1; t < threads; ++t) {
+    workers.emplace_back(fn, t);
+  }
+  fn(0);
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+//--------------------------------------------------
+/** \brief Returns $TMPDIR, or /tmp if it is unset or empty.
+ */
+inline std::string TempDirectory (void) {
+  const char *tmpdir = getenv("TMPDIR");
+  return tmpdir && *tmpdir ? tmpdir : "/tmp";
+}
+
+} // namespace
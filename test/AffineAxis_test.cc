@@ -0,0 +1,75 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <limits>
+#include <vector>
+
+#include "AffineAxis.hpp"
+#include "check.hpp"
+
+using namespace cppmpl;
+
+static std::vector<double> Axis (double start, double step, size_t count) {
+  std::vector<double> data(count);
+  for (size_t i = 0; i < count; ++i) {
+    data[i] = start + step * i;
+  }
+  return data;
+}
+
+int main (void) {
+  double start = 0.0;
+  double step = 0.0;
+  CHECK(!DetectAffine(nullptr, 0, 1.0, &start, &step));
+
+  // A single value is an axis with no step
+  const double one = 4.5;
+  CHECK(DetectAffine(&one, 1, 0.0, &start, &step));
+  CHECK(start == 4.5 && step == 0.0);
+
+  // Every length either side of the SIMD pairs and blocks
+  for (size_t count : {2, 3, 4, 5, 1023, 1024, 1025, 5000}) {
+    const std::vector<double> data = Axis(-2.0, 0.25, count);
+    start = step = 0.0;
+    CHECK(DetectAffine(data.data(), count, 0.0, &start, &step));
+    CHECK(start == -2.0 && step == 0.25);
+  }
+
+  // Any value off by more than the tolerance fails, wherever it is, and
+  // less passes
+  const double tolerance = 1e-6;
+  const size_t COUNT = 37;
+  size_t failures = 0;
+  for (size_t i = 1; i + 1 < COUNT; ++i) {
+    std::vector<double> data = Axis(10.0, 0.5, COUNT);
+    data[i] += 0.5 * tolerance;
+    failures += !DetectAffine(data.data(), COUNT, tolerance, &start, &step);
+    data[i] += 2.0 * tolerance;
+    failures += DetectAffine(data.data(), COUNT, tolerance, &start, &step);
+    data[i] = std::numeric_limits<double>::quiet_NaN();
+    failures += DetectAffine(data.data(), COUNT, tolerance, &start, &step);
+  }
+  CHECK(failures == 0);
+
+  // Non-finite ends fail, and leave start and step alone
+  std::vector<double> data = Axis(0.0, 1.0, COUNT);
+  data.back() = std::numeric_limits<double>::infinity();
+  start = step = -1.0;
+  CHECK(!DetectAffine(data.data(), COUNT, tolerance, &start, &step));
+  CHECK(start == -1.0 && step == -1.0);
+
+  // Unix timestamps are affine to within their rounding, a few tenths of a
+  // microsecond, but no closer
+  const std::vector<double> stamps = Axis(1.7e9, 1e-3, 100000);
+  CHECK(DetectAffine(stamps.data(), stamps.size(), 1e-6, &start, &step));
+  CHECK(start == 1.7e9);
+  CHECK(!DetectAffine(stamps.data(), stamps.size(), 1e-9, &start, &step));
+
+  std::vector<uint8_t> header;
+  AffineAxis("T", 1.0, 2.0, 3).SerializeHeaderTo(&header);
+  CHECK(header.size() == 3 * 8 + 1 && header.back() == 'T');
+  return TEST_RESULT();
+}
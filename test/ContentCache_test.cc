@@ -0,0 +1,53 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <cstring>
+#include <vector>
+
+#include "ContentCache.hpp"
+#include "check.hpp"
+
+using namespace cppmpl;
+
+static uint64_t Hash (const char *text, uint64_t seed = 0) {
+  return ContentHash(text, std::strlen(text), seed);
+}
+
+int main (void) {
+  // Published XXH64 test vectors
+  CHECK(Hash("") == 0xEF46DB3751D8E999ull);
+  CHECK(Hash("a") == 0xD24EC4F1A98C6E5Bull);
+  CHECK(Hash("abc") == 0x44BC2CF5AD770999ull);
+  CHECK(Hash("xxhash") == 0x32DD38952C4BC720ull);
+  CHECK(Hash("xxhash", 20141025) == 0xB559B98D844E0635ull);
+  CHECK(Hash("Nobody inspects the spammish repetition") ==
+        0xFBCEA83C8A378BF1ull);
+
+  // Lengths either side of the 32 byte lanes and the 8 byte tail, checked
+  // against an independent port of the reference implementation
+  std::vector<uint8_t> bytes(1000 + 8);
+  for (size_t i = 0; i < 1000; ++i) {
+    bytes[i] = static_cast<uint8_t>(i * 7 + 1);
+  }
+  const struct {
+    size_t size;
+    uint64_t hash;
+  } lengths[] = {
+    {8, 0xC6F1803A5E0B3222ull}, {15, 0x514C6F58D37CE6F1ull},
+    {31, 0x6AB1C40E29F50073ull}, {32, 0x5A0756FBE9ECD3D1ull},
+    {63, 0x10DD94885C71894Aull}, {64, 0x90083DA9CDB9D795ull},
+    {100, 0xD248BFC5208B0B16ull}, {1000, 0x6BE03ACBF959C413ull}};
+  for (const auto &length : lengths) {
+    CHECK(ContentHash(bytes.data(), length.size) == length.hash);
+  }
+
+  // The same bytes at any alignment hash the same
+  for (size_t offset = 1; offset < 8; ++offset) {
+    std::memmove(&bytes[offset], &bytes[offset - 1], 1000);
+    CHECK(ContentHash(&bytes[offset], 1000) == 0x6BE03ACBF959C413ull);
+  }
+  return TEST_RESULT();
+}
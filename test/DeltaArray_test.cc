@@ -0,0 +1,100 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <stdexcept>
+#include <vector>
+
+#include "DeltaArray.hpp"
+#include "check.hpp"
+
+using namespace cppmpl;
+
+typedef DeltaArray::Range Range;
+
+static bool SameRanges (const std::vector<Range> &ranges,
+                        const std::vector<Range> &expected) {
+  if (ranges.size() != expected.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    if (ranges[i].begin != expected[i].begin ||
+        ranges[i].end != expected[i].end) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The values Update should have packed for its ranges
+static std::vector<double> Packed (const std::vector<double> &data,
+                                   const std::vector<Range> &ranges) {
+  std::vector<double> values;
+  for (const Range &range : ranges) {
+    values.insert(values.end(), data.begin() + range.begin,
+                  data.begin() + range.end);
+  }
+  return values;
+}
+
+int main (void) {
+  // 30 values in blocks of 4, the last block partial
+  DeltaArray array("Delta", 5, 6, 4);
+  std::vector<double> data(30);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = i;
+  }
+
+  // The first update is the whole array, sent as the data itself
+  CHECK(array.Update(data.data()) == 30);
+  CHECK(array.IsFull());
+  CHECK(SameRanges(array.Ranges(), {{0, 30}}));
+  CHECK(array.Values().empty());
+
+  // then nothing, until something changes
+  CHECK(array.Update(data.data()) == 0);
+  CHECK(!array.IsFull());
+  CHECK(array.Ranges().empty());
+
+  // Changed blocks are sent whole, adjacent ones as one range
+  data[1] = -1;
+  data[9] = -1;
+  data[14] = -1;
+  data[29] = -1;
+  CHECK(array.Update(data.data()) == 4 + 8 + 2);
+  CHECK(SameRanges(array.Ranges(), {{0, 4}, {8, 16}, {28, 30}}));
+  CHECK(array.Values() == Packed(data, array.Ranges()));
+
+  // Ranges from the caller are sorted and merged where they overlap or
+  // touch, and empty ones dropped
+  data[3] = -2;
+  data[11] = -2;
+  CHECK(array.Update(data.data(), {{10, 12}, {2, 5}, {7, 7}, {4, 7}}) == 7);
+  CHECK(SameRanges(array.Ranges(), {{2, 7}, {10, 12}}));
+  CHECK(array.Values() == Packed(data, array.Ranges()));
+
+  // and keep the comparison copy current
+  CHECK(array.Update(data.data()) == 0);
+
+  bool threw = false;
+  try {
+    array.Update(data.data(), {{29, 31}});
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  // Reset sends the whole array again
+  array.Reset();
+  CHECK(array.Update(data.data(), {{0, 1}}) == 30);
+  CHECK(array.IsFull());
+
+  std::vector<uint8_t> header;
+  array.SerializeHeaderTo(&header);
+  const std::vector<uint8_t> expected{5, 0, 0, 0, 6, 0, 0, 0, 1,
+                                      'D', 'e', 'l', 't', 'a'};
+  CHECK(header == expected);
+  return TEST_RESULT();
+}
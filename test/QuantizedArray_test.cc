@@ -0,0 +1,163 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "QuantizedArray.hpp"
+#include "check.hpp"
+
+using namespace cppmpl;
+
+typedef QuantizedArray::Encoding Encoding;
+typedef QuantizedArray::Precision Precision;
+
+static const size_t ROWS = 37;
+static const size_t COLS = 29;
+static const size_t CHUNK = 100;
+
+// Relative errors of float16, allowing for the rounding to float on the
+// way, and of float32
+static const double HALF_ERROR = std::ldexp(1.0, -11) + std::ldexp(1.0, -23);
+static const double FLOAT_ERROR = std::ldexp(1.0, -24);
+
+static double FromHalf (uint16_t half) {
+  const double sign = half & 0x8000 ? -1.0 : 1.0;
+  const int exponent = (half >> 10) & 0x1f;
+  const int mantissa = half & 0x3ff;
+  if (exponent == 0x1f) {
+    return mantissa ? std::numeric_limits<double>::quiet_NaN()
+                    : sign * std::numeric_limits<double>::infinity();
+  }
+  if (exponent == 0) {
+    return sign * std::ldexp(mantissa, -24);
+  }
+  return sign * std::ldexp(1024 + mantissa, exponent - 25);
+}
+
+// What the listener makes of the array
+static std::vector<double> Decode (const QuantizedArray &array) {
+  const size_t count = array.Rows() * array.Cols();
+  const uint8_t *codes = array.Codes().data();
+  std::vector<double> values(count);
+  for (size_t i = 0; i < count; ++i) {
+    const double offset = array.Params()[2 * (i / CHUNK)];
+    const double scale = array.Params()[2 * (i / CHUNK) + 1];
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    uint16_t u16;
+    float f32;
+    switch (array.GetEncoding()) {
+    case Encoding::UINT8:
+      values[i] = codes[i] == 255 ? nan : codes[i] * scale + offset;
+      break;
+    case Encoding::UINT16:
+      std::memcpy(&u16, codes + 2 * i, sizeof(u16));
+      values[i] = u16 == 65535 ? nan : u16 * scale + offset;
+      break;
+    case Encoding::FLOAT16:
+      std::memcpy(&u16, codes + 2 * i, sizeof(u16));
+      values[i] = FromHalf(u16) * scale;
+      break;
+    case Encoding::FLOAT32:
+      std::memcpy(&f32, codes + 4 * i, sizeof(f32));
+      values[i] = f32;
+      break;
+    case Encoding::FLOAT64:
+      std::memcpy(&values[i], codes + 8 * i, sizeof(double));
+      break;
+    }
+  }
+  return values;
+}
+
+// Values spread over span around a different centre in each chunk, with a
+// NaN and, in the last chunk, an infinity
+static std::vector<double> Data (double span, bool positive) {
+  std::mt19937 random(42);
+  std::uniform_real_distribution<double> uniform(0.001, 1.0);
+  std::vector<double> data(ROWS * COLS);
+  for (size_t i = 0; i < data.size(); ++i) {
+    const double centre = positive ? 0.0 : 1000.0 * (i / CHUNK);
+    const double sign = positive || random() % 2 ? 1.0 : -1.0;
+    data[i] = centre + sign * span * uniform(random);
+  }
+  data[5] = std::numeric_limits<double>::quiet_NaN();
+  data.back() = std::numeric_limits<double>::infinity();
+  return data;
+}
+
+// Checks every finite value is within bound(x) of x, and NaN stays NaN
+template <typename Bound>
+static void CheckBound (const std::vector<double> &data, Precision precision,
+                        Encoding encoding, bool keeps_infinity, Bound bound) {
+  QuantizedArray array("Q", data.data(), ROWS, COLS, precision, CHUNK);
+  CHECK(array.GetEncoding() == encoding);
+  const std::vector<double> decoded = Decode(array);
+  size_t failures = 0;
+  for (size_t i = 0; i < data.size(); ++i) {
+    if (std::isnan(data[i])) {
+      failures += !std::isnan(decoded[i]);
+    } else if (std::isinf(data[i])) {
+      failures += keeps_infinity ? decoded[i] != data[i]
+                                 : !std::isnan(decoded[i]);
+    } else {
+      failures += !(std::fabs(decoded[i] - data[i]) <= bound(data[i]));
+    }
+  }
+  CHECK(failures == 0);
+}
+
+int main (void) {
+  // Each chunk spans nearly 2, so the bound decides the integer width.  The
+  // bounds are just above half a step, so codes must be rounded to nearest.
+  const std::vector<double> data = Data(1.0, false);
+  CheckBound(data, Precision::AbsoluteError(0.004), Encoding::UINT8, false,
+             [] (double) { return 0.004; });
+  CheckBound(data, Precision::AbsoluteError(2e-5), Encoding::UINT16, false,
+             [] (double) { return 2e-5; });
+  CheckBound(data, Precision::AbsoluteError(1e-9), Encoding::FLOAT64, true,
+             [] (double) { return 0.0; });
+
+  // Significant bits bound the relative error
+  const std::vector<double> large = Data(1e6, false);
+  CheckBound(large, Precision::SignificantBits(11), Encoding::FLOAT16, true,
+             [] (double x) { return std::fabs(x) * HALF_ERROR; });
+  CheckBound(large, Precision::SignificantBits(24), Encoding::FLOAT32, true,
+             [] (double x) { return std::fabs(x) * FLOAT_ERROR; });
+  CheckBound(large, Precision::SignificantBits(53), Encoding::FLOAT64, true,
+             [] (double) { return 0.0; });
+
+  // float16 is scaled per chunk, so tiny values keep their bits too
+  const std::vector<double> tiny = Data(1e-12, true);
+  CheckBound(tiny, Precision::SignificantBits(8), Encoding::FLOAT16, true,
+             [] (double x) { return std::fabs(x) * HALF_ERROR; });
+
+  // A constant chunk is exact
+  std::vector<double> constant(ROWS * COLS, 3.25);
+  CheckBound(constant, Precision::AbsoluteError(0.5), Encoding::UINT8, false,
+             [] (double) { return 0.0; });
+
+  // SetData requantizes a new shape with the same precision
+  QuantizedArray array("Q", data.data(), ROWS, COLS,
+                       Precision::AbsoluteError(0.01), CHUNK);
+  array.SetData(data.data(), 3, 5);
+  CHECK(array.Rows() == 3 && array.Cols() == 5);
+  CHECK(array.Codes().size() == 15);
+  CHECK(array.Params().size() == 2);
+
+  bool threw = false;
+  try {
+    Precision::AbsoluteError(0.0);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  CHECK(threw);
+  return TEST_RESULT();
+}
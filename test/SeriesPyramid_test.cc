@@ -0,0 +1,109 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "SeriesPyramid.hpp"
+#include "check.hpp"
+
+using namespace cppmpl;
+
+// Checks a query against the samples it covers
+static void CheckQuery (const SeriesPyramid &pyramid,
+                        const std::vector<double> &samples,
+                        uint64_t first, uint64_t last, size_t pixels) {
+  const SeriesPyramid::View view = pyramid.Query(first, last, pixels);
+  last = std::min<uint64_t>(last, samples.size());
+
+  // The coarsest level with at least pixels blocks across the window
+  const uint64_t span = last - first;
+  uint8_t level = 0;
+  uint64_t block = 1;
+  for (uint64_t size = 64; span / size >= pixels; size *= 4) {
+    ++level;
+    block = size;
+  }
+  CHECK(view.level == level);
+  CHECK(view.block == block);
+  CHECK(view.first == first / block * block);
+
+  if (level == 0) {
+    CHECK(view.mins.size() == span &&
+          std::equal(view.mins.begin(), view.mins.end(),
+                     samples.begin() + first, [] (double a, double b) {
+                       return a == b || (std::isnan(a) && std::isnan(b));
+                     }));
+    CHECK(view.maxs.empty());
+    return;
+  }
+  const uint64_t points = (last + block - 1) / block - first / block;
+  CHECK(view.mins.size() == points);
+  CHECK(view.maxs.size() == points);
+  size_t failures = 0;
+  for (size_t i = 0; i < std::min<size_t>(points, view.mins.size()); ++i) {
+    const uint64_t begin = view.first + i * block;
+    const uint64_t end = std::min<uint64_t>(samples.size(), begin + block);
+    double low = std::numeric_limits<double>::infinity();
+    double high = -low;
+    for (uint64_t j = begin; j != end; ++j) {
+      if (!std::isnan(samples[j])) {
+        low = std::min(low, samples[j]);
+        high = std::max(high, samples[j]);
+      }
+    }
+    failures += view.mins[i] != low || view.maxs[i] != high;
+  }
+  CHECK(failures == 0);
+}
+
+int main (void) {
+  std::mt19937 random(7);
+  std::normal_distribution<double> normal;
+  std::vector<double> samples;
+  SeriesPyramid pyramid("Series", 0.0, 1.0, 4);
+
+  // Grown in uneven steps, one large enough to build in parallel, from a
+  // vector that reallocates as it grows.  Sample 500 is NaN, which blocks
+  // skip.
+  for (size_t size : {1, 63, 64, 65, 1000, 300000, 300001, 350017}) {
+    while (samples.size() < size) {
+      samples.push_back(samples.size() == 500
+                        ? std::numeric_limits<double>::quiet_NaN()
+                        : normal(random));
+    }
+    pyramid.Extend(samples.data(), samples.size());
+    CHECK(pyramid.Count() == samples.size());
+    CheckQuery(pyramid, samples, 0, samples.size(), 100);
+  }
+
+  CheckQuery(pyramid, samples, 0, samples.size(), 1);
+  CheckQuery(pyramid, samples, 12345, 290000, 100);
+  CheckQuery(pyramid, samples, 12345, 290000, 5000);
+  CheckQuery(pyramid, samples, 449, 551, 2);
+  CheckQuery(pyramid, samples, 449, 551, 1000);
+  CheckQuery(pyramid, samples, 349000, 1 << 30, 10);
+  CheckQuery(pyramid, samples, 350017, 350017, 10);
+
+  // The pyramid has its own copy of the samples
+  const double kept = samples[10];
+  samples[10] = 1e9;
+  CHECK(pyramid.Query(10, 11, 1).mins == std::vector<double>{kept});
+  samples[10] = kept;
+
+  bool threw = false;
+  try {
+    pyramid.Extend(samples.data(), samples.size() - 1);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  CHECK(threw);
+  return TEST_RESULT();
+}
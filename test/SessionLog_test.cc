@@ -0,0 +1,94 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "SessionLog.hpp"
+#include "check.hpp"
+#include "wire_util.hpp"
+
+using namespace cppmpl;
+
+// The payload of record i, of size bytes
+static std::vector<uint8_t> Payload (size_t i, size_t size) {
+  std::vector<uint8_t> payload(size);
+  for (size_t j = 0; j < size; ++j) {
+    payload[j] = static_cast<uint8_t>(i * 31 + j);
+  }
+  return payload;
+}
+
+int main (void) {
+  const std::string path = TempDirectory() + "/cpp_mpl_session_test_" +
+                           std::to_string(getpid()) + ".cpplog";
+
+  // Enough records to grow the index, and one large enough to grow the log
+  const size_t RECORDS = 20000;
+  const size_t LARGE = 17;
+  auto size_of = [&] (size_t i) -> size_t {
+    return i == LARGE ? (20 << 20) : i % 13;
+  };
+  {
+    SessionRecorder recorder{path};
+    for (size_t i = 0; i < RECORDS; ++i) {
+      const std::vector<uint8_t> payload = Payload(i, size_of(i));
+      recorder.Append(i % 2 ? RecordType::CODE : RecordType::DATA,
+                      payload.data(), payload.size());
+    }
+  }
+
+  {
+    SessionReplayer replayer{path};
+    CHECK(replayer.Records() == RECORDS);
+    uint64_t time_ns = 0;
+    for (size_t i = 0; i < replayer.Records(); ++i) {
+      const SessionReplayer::Record record = replayer.Get(i);
+      const std::vector<uint8_t> payload = Payload(i, size_of(i));
+      CHECK(record.type == (i % 2 ? RecordType::CODE : RecordType::DATA));
+      CHECK(record.size == payload.size());
+      CHECK(payload.empty() ||
+            std::memcmp(record.data, payload.data(), payload.size()) == 0);
+      CHECK(record.time_ns >= time_ns);
+      time_ns = record.time_ns;
+    }
+  }
+
+  // A log cut short by a crash keeps its earlier records, and Get reports
+  // the one that was cut
+  struct stat info;
+  CHECK(stat(path.c_str(), &info) == 0);
+  CHECK(truncate(path.c_str(), info.st_size - 8) == 0);
+  {
+    SessionReplayer replayer{path};
+    CHECK(replayer.Get(RECORDS - 2).size == size_of(RECORDS - 2));
+    bool threw = false;
+    try {
+      replayer.Get(RECORDS - 1);
+    } catch (const std::runtime_error&) {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+
+  // and anything else is not taken for a log
+  bool threw = false;
+  try {
+    SessionReplayer replayer{path + ".idx"};
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  unlink(path.c_str());
+  unlink((path + ".idx").c_str());
+  return TEST_RESULT();
+}
@@ -0,0 +1,40 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+#include <vector>
+
+#include "block_compare.hpp"
+#include "check.hpp"
+
+using namespace cppmpl;
+
+int main (void) {
+  // Sizes either side of the 64 byte steps, at every alignment
+  std::vector<uint8_t> a(300), b(300);
+  for (size_t i = 0; i < a.size(); ++i) {
+    a[i] = b[i] = static_cast<uint8_t>(i * 7 + 3);
+  }
+  for (size_t offset = 0; offset < 16; ++offset) {
+    for (size_t size = 0; size + offset <= 200; ++size) {
+      CHECK(BlocksEqual(&a[offset], &b[offset], size));
+    }
+  }
+
+  // A single differing byte is found wherever it is
+  for (size_t size = 1; size <= 200; ++size) {
+    for (size_t i = 0; i < size; ++i) {
+      b[i + 3] ^= 0x80;
+      CHECK(!BlocksEqual(&a[3], &b[3], size));
+      b[i + 3] ^= 0x80;
+    }
+  }
+
+  // and bytes past the end are not compared
+  b[100] ^= 1;
+  CHECK(BlocksEqual(a.data(), b.data(), 100));
+  CHECK(!BlocksEqual(a.data(), b.data(), 101));
+  return TEST_RESULT();
+}
@@ -0,0 +1,34 @@
+//
+// Copyright (c) 2015 Jim Youngquist
+// under The MIT License (MIT)
+// full text in LICENSE file in root folder of this project.
+//
+
+// A minimal check for the unit tests, which are plain executables that
+// print each failed check and return nonzero if there was one.
+
+#pragma once
+
+#include <cstdio>
+
+namespace cppmpl {
+namespace test {
+
+inline int& Failures (void) {
+  static int failures = 0;
+  return failures;
+}
+
+} // namespace
+} // namespace
+
+#define CHECK(condition)                                                \
+  do {                                                                  \
+    if (!(condition)) {                                                 \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,       \
+                   __LINE__, #condition);                               \
+      ++cppmpl::test::Failures();                                       \
+    }                                                                   \
+  } while (0)
+
+#define TEST_RESULT() (cppmpl::test::Failures() == 0 ? 0 : 1)